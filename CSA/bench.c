@@ -0,0 +1,781 @@
+// Throughput benchmarks for the CSA.
+// Usage : ./csabench <workload>
+//         ./csabench suite [results.csv [label]]
+// Needs the csa_foreach() extension.
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "csa.h"
+#include "csa_pack.h"
+#include "csa_wide.h"
+
+#define LOOKUP_BLOCKS 20000
+#define LOOKUP_PERBLK 8
+#define LOOKUP_OPS    (1 << 18)
+#define SCATTER_N     1000000
+// Bigger than a block, so nearly every index opens a new one
+#define SCATTER_STEP  131
+#define BULK_N        10000000
+#define BULK_STEP     3
+#define REDUCE_N      (1 << 22)
+#define REDUCE_REPS   20
+#define STARTUP_N     (1 << 23)
+#define PACK_N        (1 << 20)
+#define PACK_GETS     (1 << 21)
+#define DENSITY_SPAN  (1 << 22)
+#define DENSITY_GETS  (1 << 20)
+#define DENSE_N       (1 << 22)
+#define DENSE_GETS    (1 << 22)
+#define DENSE_TOGGLES (1 << 16)
+// The suite : every case runs SUITE_WARMUP times untimed, then SUITE_REPS times
+#define SUITE_WARMUP  1
+#define SUITE_REPS    5
+#define SUITE_N       (1 << 20)
+#define SPARSE_SPAN   (1 << 28)
+#define HOT_KEYS      64
+#define CHURN_SPAN    (1 << 16)
+#define SIEVE_MAX     10000000
+// Short-lived memo tables, each made, filled & thrown away
+#define SCRATCH_ARRAYS 20000
+#define SCRATCH_SETS   500
+#define SCRATCH_BYTES  (1 << 20)
+#define SNAP_N        (1 << 21)
+#define SNAP_SPAN     (1 << 23)
+#define SNAP_GETS     (1 << 22)
+
+typedef struct {
+   const char* name;
+   void (*run)(void);
+} workload;
+
+// One timed run of a suite case : returns the operations done, & their time in *secs
+typedef struct {
+   const char* name;
+   long (*run)(double* secs);
+} suitecase;
+
+double now(void);
+uint64_t xorshift(uint64_t* s);
+long peak_rss_kb(void);
+void lookup(void);
+void scatter(void);
+void bulk(void);
+void reduce(void);
+void startup(void);
+void pack(void);
+size_t csa_bytes(csa* c);
+void density(void);
+void dense(void);
+void scratch(void);
+void snapshot(void);
+void* writer(void* arg);
+double snapReads(csa* s);
+size_t ownBytes(csa* c);
+void sum(int* p, int* ac);
+void dblit(int* p, int* ac);
+int suite(const char* csv, const char* label);
+int cmpdouble(const void* a, const void* b);
+long seqfill(double* secs);
+long sparsefill(double* secs);
+long randget(double* secs);
+long hotkey(double* secs);
+long churn(double* secs);
+long scan(double* secs);
+long sieve(double* secs);
+
+static const workload workloads[] = {
+   {"lookup", lookup},
+   {"scatter", scatter},
+   {"bulk", bulk},
+   {"reduce", reduce},
+   {"startup", startup},
+   {"pack", pack},
+   {"density", density},
+   {"dense", dense},
+   {"scratch", scratch},
+   {"snapshot", snapshot}
+};
+#define NUMWORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+static const suitecase cases[] = {
+   {"seqfill", seqfill},
+   {"sparsefill", sparsefill},
+   {"randget", randget},
+   {"hotkey", hotkey},
+   {"churn", churn},
+   {"foreach", scan},
+   {"sieve", sieve}
+};
+#define NUMCASES (int)(sizeof(cases) / sizeof(cases[0]))
+
+int main(int argc, char* argv[])
+{
+   if(argc >= 2 && argc <= 4 && strcmp(argv[1], "suite")==0){
+      return suite((argc > 2) ? argv[2] : NULL, (argc > 3) ? argv[3] : "");
+   }
+   if(argc != 2){
+      fprintf(stderr, "Usage : %s <workload>\n", argv[0]);
+      fprintf(stderr, "        %s suite [results.csv [label]]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   for(int i=0; i<NUMWORKLOADS; i++){
+      if(strcmp(argv[1], workloads[i].name)==0){
+         workloads[i].run();
+         return EXIT_SUCCESS;
+      }
+   }
+   fprintf(stderr, "Unknown workload %s\n", argv[1]);
+   return EXIT_FAILURE;
+}
+
+// Wall-clock seconds
+double now(void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+// Small, fast & reproducible - rand() is too short on some platforms
+uint64_t xorshift(uint64_t* s)
+{
+   *s ^= *s << 13;
+   *s ^= *s >> 7;
+   *s ^= *s << 17;
+   return *s;
+}
+
+// Peak resident set size of this process so far
+long peak_rss_kb(void)
+{
+   struct rusage r;
+   getrusage(RUSAGE_SELF, &r);
+#ifdef __APPLE__
+   // macOS reports bytes, Linux kilobytes
+   return r.ru_maxrss / 1024;
+#else
+   return r.ru_maxrss;
+#endif
+}
+
+// Random-access get/set over many sparsely populated blocks
+void lookup(void)
+{
+   csa* c = csa_init();
+   uint64_t seed = 88172645463325252ull;
+   int span = LOOKUP_BLOCKS * MSKLEN;
+   for(int b=0; b<LOOKUP_BLOCKS; b++){
+      for(int i=0; i<LOOKUP_PERBLK; i++){
+         assert(csa_set(c, b*MSKLEN + i*(MSKLEN/LOOKUP_PERBLK), i));
+      }
+   }
+
+   int hits = 0, n;
+   double t = now();
+   for(int i=0; i<LOOKUP_OPS; i++){
+      hits += csa_get(c, (int)(xorshift(&seed) % (uint64_t)span), &n);
+   }
+   double tget = now() - t;
+
+   t = now();
+   for(int i=0; i<LOOKUP_OPS; i++){
+      int blk = (int)(xorshift(&seed) % LOOKUP_BLOCKS);
+      csa_set(c, blk*MSKLEN + (i%LOOKUP_PERBLK)*(MSKLEN/LOOKUP_PERBLK), i);
+   }
+   double tset = now() - t;
+
+   printf("lookup: %d blocks, get %.2f Mops/s (%d hits), set %.2f Mops/s\n",
+          LOOKUP_BLOCKS, LOOKUP_OPS / tget / 1e6, hits, LOOKUP_OPS / tset / 1e6);
+   csa_free(&c);
+}
+
+// Many distinct 64-index windows, so the block directory keeps growing
+void scatter(void)
+{
+   csa* c = csa_init();
+   double t = now();
+   for(int i=0; i<SCATTER_N; i++){
+      assert(csa_set(c, i*SCATTER_STEP, i));
+   }
+   t = now() - t;
+   printf("scatter: %d indices in %d blocks, %.3f s, peak RSS %ld kB\n",
+          SCATTER_N, c->n, t, peak_rss_kb());
+   csa_free(&c);
+}
+
+// Loading a big sorted sparse vector one csa_set() at a time vs csa_set_many()
+void bulk(void)
+{
+   int* idx = (int*)malloc(BULK_N * sizeof(int));
+   int* val = (int*)malloc(BULK_N * sizeof(int));
+   assert(idx && val);
+   for(int i=0; i<BULK_N; i++){
+      idx[i] = i * BULK_STEP;
+      val[i] = i;
+   }
+
+   csa* c = csa_init();
+   double t = now();
+   for(int i=0; i<BULK_N; i++){
+      csa_set(c, idx[i], val[i]);
+   }
+   double tone = now() - t;
+   csa_free(&c);
+
+   c = csa_init();
+   t = now();
+   assert(csa_set_many(c, idx, val, BULK_N));
+   double tmany = now() - t;
+
+   t = now();
+   int got = 0, from = 0, n;
+   while((n = csa_export(c, from, idx + got, val + got, BULK_N - got)) > 0){
+      got += n;
+      from = idx[got-1] + 1;
+   }
+   double texport = now() - t;
+   assert(got == BULK_N);
+
+   printf("bulk: %d entries, csa_set %.3f s, csa_set_many %.3f s, csa_export %.3f s\n",
+          BULK_N, tone, tmany, texport);
+   csa_free(&c);
+   free(idx);
+   free(val);
+}
+
+// Built-in kernels vs the csa_foreach() callbacks used by driver.c
+void reduce(void)
+{
+   static const char* names[] = {"scalar", "sse4.1", "avx2"};
+   csa* c = csa_init();
+   for(int i=0; i<REDUCE_N; i++){
+      // 7 in every 8 cells set, so most blocks are neither full nor empty
+      if(i%8){
+         assert(csa_set(c, i, i%1000));
+      }
+   }
+
+   int acc = 0;
+   double t = now();
+   for(int r=0; r<REDUCE_REPS; r++){
+      acc = 0;
+      csa_foreach(sum, c, &acc);
+   }
+   double tsum = now() - t;
+   t = now();
+   for(int r=0; r<REDUCE_REPS; r++){
+      csa_foreach(dblit, c, &acc);
+   }
+   double tdbl = now() - t;
+   printf("reduce: %d values, foreach(sum) %.2f ms, foreach(dblit) %.2f ms\n",
+          csa_range_count(c, 0, REDUCE_N), tsum * 1e3 / REDUCE_REPS, tdbl * 1e3 / REDUCE_REPS);
+
+   for(int k=0; k<(int)(sizeof(names)/sizeof(names[0])); k++){
+      if(!csa_simd_select(names[k])){
+         continue;
+      }
+      t = now();
+      for(int r=0; r<REDUCE_REPS; r++){
+         acc += (int)csa_sum(c);
+      }
+      double tk = now() - t;
+      t = now();
+      for(int r=0; r<REDUCE_REPS; r++){
+         csa_scale(c, 2);
+      }
+      double tscale = now() - t;
+      printf("reduce: %-7s csa_sum %.2f ms, csa_scale %.2f ms\n",
+             names[k], tk * 1e3 / REDUCE_REPS, tscale * 1e3 / REDUCE_REPS);
+   }
+   csa_simd_select(NULL);
+   csa_free(&c);
+}
+
+void sum(int* p, int* ac)
+{
+   *ac += *p;
+}
+
+void dblit(int* p, int* ac)
+{
+   *ac = 0;
+   *p *= 2;
+}
+
+// Rebuilding a big CSA from text vs mapping a file saved by csa_save()
+void startup(void)
+{
+   const char* text = "startup.txt";
+   const char* file = "startup.csa";
+   int* idx = (int*)malloc(STARTUP_N * sizeof(int));
+   int* val = (int*)malloc(STARTUP_N * sizeof(int));
+   assert(idx && val);
+   csa* c = csa_init();
+   for(int i=0; i<STARTUP_N; i++){
+      idx[i] = i + i/3;
+      val[i] = i;
+   }
+   assert(csa_set_many(c, idx, val, STARTUP_N));
+   FILE* f = fopen(text, "w");
+   assert(f);
+   for(int i=0; i<STARTUP_N; i++){
+      fprintf(f, "%d %d\n", idx[i], val[i]);
+   }
+   assert(fclose(f)==0);
+   double t = now();
+   assert(csa_save(c, file));
+   double tsave = now() - t;
+   long long want = csa_sum(c);
+   csa_free(&c);
+
+   t = now();
+   f = fopen(text, "r");
+   assert(f);
+   int n = 0;
+   while(n<STARTUP_N && fscanf(f, "%d %d", &idx[n], &val[n])==2){
+      n++;
+   }
+   fclose(f);
+   c = csa_init();
+   assert(csa_set_many(c, idx, val, n));
+   double ttext = now() - t;
+   csa_free(&c);
+
+   t = now();
+   c = csa_open_mmap(file);
+   int got;
+   assert(c && csa_get(c, idx[n/2], &got) && got==val[n/2]);
+   double tmap = now() - t;
+   // Reading it all pulls every page in
+   t = now();
+   assert(csa_sum(c)==want);
+   double tsum = now() - t;
+
+   printf("startup: %d values, csa_save %.3f s, text load %.3f s, csa_open_mmap + csa_get %.3f ms, then csa_sum %.3f s\n",
+          n, tsave, ttext, tmap * 1e3, tsum);
+   csa_free(&c);
+   remove(text);
+   remove(file);
+   free(idx);
+   free(val);
+}
+
+// Heap taken by a (non-mapped) CSA, headers included
+size_t csa_bytes(csa* c)
+{
+   size_t bytes = sizeof(csa) + c->cap * sizeof(block);
+   for(int b=0; b<c->n; b++){
+      bytes += c->b[b].cap * sizeof(int);
+   }
+   return bytes;
+}
+
+// Bytes per entry & random get latency for each packed encoding, on 3 in every 4 cells
+void pack(void)
+{
+   static const char* kinds[] = {"small", "sorted", "random"};
+   static const char* encs[] = {"auto", "raw", "for", "delta"};
+   for(int k=0; k<3; k++){
+      uint64_t seed = 88172645463325252ull;
+      csa* c = csa_init();
+      for(int i=0, v=0; i<PACK_N; i++){
+         if(i%4){
+            v = (k==0) ? (int)(xorshift(&seed) % 100) : ((k==1) ? v + (int)(xorshift(&seed) % 50) : (int)xorshift(&seed));
+            assert(csa_set(c, i, v));
+         }
+      }
+      int count = csa_range_count(c, 0, PACK_N), n;
+      long long hits = 0, want = csa_sum(c);
+      double t = now();
+      for(int i=0; i<PACK_GETS; i++){
+         hits += csa_get(c, (int)(xorshift(&seed) % PACK_N), &n) ? n : 0;
+      }
+      printf("pack: %-6s csa       %5.2f bytes/entry, get %5.1f ns\n",
+             kinds[k], (double)csa_bytes(c) / count, (now() - t) * 1e9 / PACK_GETS);
+      for(csa_encoding e=csa_enc_auto; e<=csa_enc_delta; e++){
+         csa_packed* p = csa_pack(c, e);
+         assert(p);
+         t = now();
+         for(int i=0; i<PACK_GETS; i++){
+            hits += csa_packed_get(p, (int)(xorshift(&seed) % PACK_N), &n) ? n : 0;
+         }
+         double tget = now() - t;
+         t = now();
+         long long got = csa_packed_sum(p);
+         double tsum = now() - t;
+         assert(got==want);
+         printf("pack: %-6s %-9s %5.2f bytes/entry, get %5.1f ns, sum %.2f ms\n",
+                kinds[k], encs[e], (double)csa_packed_bytes(p) / count, tget * 1e9 / PACK_GETS, tsum * 1e3);
+         csa_packed_free(&p);
+      }
+      // Keeps the gets from being optimised away
+      if(hits==42){
+         printf("\n");
+      }
+      csa_free(&c);
+   }
+}
+
+// CSV, for plotting : bytes/entry & random get latency of the CSA and each block width, from 0.1% to 100% full
+void density(void)
+{
+   static const double fill[] = {0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 1.0};
+   printf("density,layout,bytes_per_entry,get_ns\n");
+   for(int d=0; d<(int)(sizeof(fill)/sizeof(fill[0])); d++){
+      uint64_t seed = 88172645463325252ull;
+      csa* c = csa_init();
+      for(int i=0; i<DENSITY_SPAN; i++){
+         if((double)(xorshift(&seed) % 1000000) < fill[d] * 1e6){
+            assert(csa_set(c, i, i));
+         }
+      }
+      int count = csa_range_count(c, 0, DENSITY_SPAN), n;
+      long long hits = 0;
+      double t = now();
+      for(int i=0; i<DENSITY_GETS; i++){
+         hits += csa_get(c, (int)(xorshift(&seed) % DENSITY_SPAN), &n);
+      }
+      printf("%g,csa,%.2f,%.1f\n", fill[d] * 100, (double)csa_bytes(c) / count, (now() - t) * 1e9 / DENSITY_GETS);
+      // 0 is csa_wide_pick()'s choice
+      for(int width=0; width<=CSA_WIDE_MAX; width=(width ? width*2 : 64)){
+         csa_wide* w = csa_wide_from(c, width);
+         assert(w);
+         t = now();
+         for(int i=0; i<DENSITY_GETS; i++){
+            hits += csa_wide_get(w, (int)(xorshift(&seed) % DENSITY_SPAN), &n);
+         }
+         double tget = now() - t;
+         char layout[16];
+         snprintf(layout, sizeof(layout), width ? "wide%d" : "auto%d", w->width);
+         printf("%g,%s,%.2f,%.1f\n", fill[d] * 100, layout, (double)csa_wide_bytes(w) / count, tget * 1e9 / DENSITY_GETS);
+         csa_wide_free(&w);
+      }
+      if(hits<0){
+         printf("\n");
+      }
+      csa_free(&c);
+   }
+}
+
+// Random gets over a completely full stretch (one dense segment) vs one missing a cell per block,
+// then deleting & setting back one cell in the middle of the full one
+void dense(void)
+{
+   for(int gap=0; gap<2; gap++){
+      uint64_t seed = 88172645463325252ull;
+      csa* c = csa_init();
+      double t = now();
+      for(int i=0; i<DENSE_N; i++){
+         if(!gap || i%MSKLEN != MSKLEN-1){
+            assert(csa_set(c, i, i));
+         }
+      }
+      double tfill = now() - t;
+      long long hits = 0;
+      int n;
+      t = now();
+      for(int i=0; i<DENSE_GETS; i++){
+         hits += csa_get(c, (int)(xorshift(&seed) % DENSE_N), &n) ? n : 0;
+      }
+      double tget = now() - t;
+      printf("dense: %s, %d segment%s, fill %.1f ns/op, get %.1f ns/op (%lld)\n",
+             gap ? "63 of 64 set" : "all set     ", c->ndense, (c->ndense == 1) ? "" : "s",
+             tfill * 1e9 / DENSE_N, tget * 1e9 / DENSE_GETS, hits);
+      if(!gap){
+         t = now();
+         for(int i=0; i<DENSE_TOGGLES; i++){
+            assert(csa_delete(c, DENSE_N/2) && csa_set(c, DENSE_N/2, i));
+         }
+         double ttoggle = now() - t;
+         printf("dense: one cell toggled, %d segments, %.1f ns/op\n", c->ndense, ttoggle * 1e9 / DENSE_TOGGLES);
+      }
+      csa_free(&c);
+   }
+}
+
+// The same memo-table lifetime with malloc() per block & with one reused arena
+void scratch(void)
+{
+   static unsigned char buf[SCRATCH_BYTES];
+   csa_arena a;
+   csa_arena_init(&a, buf, sizeof(buf));
+   for(int arena=0; arena<2; arena++){
+      uint64_t seed = 88172645463325252ull;
+      long long total = 0;
+      double t = now();
+      for(int r=0; r<SCRATCH_ARRAYS; r++){
+         csa* c = arena ? csa_init_arena(&a) : csa_init();
+         assert(c);
+         for(int i=0; i<SCRATCH_SETS; i++){
+            assert(csa_set(c, (int)(xorshift(&seed) % (SCRATCH_SETS*8)), i));
+         }
+         total += csa_sum(c);
+         csa_free(&c);
+         if(arena){
+            csa_arena_reset(&a);
+         }
+      }
+      double secs = now() - t;
+      printf("scratch: %s %.2f us per array (%lld)\n", arena ? "arena " : "malloc", secs * 1e6 / SCRATCH_ARRAYS, total);
+   }
+}
+
+// What a writer thread is given : it sets random cells of c until *stop
+typedef struct {
+   csa* c;
+   int stop;
+   long writes;
+} writeJob;
+
+void* writer(void* arg)
+{
+   writeJob* w = (writeJob*)arg;
+   uint64_t seed = 2463534242ull;
+   while(!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)){
+      assert(csa_set(w->c, (int)(xorshift(&seed) % SNAP_SPAN), (int)w->writes));
+      w->writes++;
+   }
+   return NULL;
+}
+
+// ns per random csa_get on s
+double snapReads(csa* s)
+{
+   uint64_t seed = 88172645463325252ull;
+   long long hits = 0;
+   int n;
+   double t = now();
+   for(int i=0; i<SNAP_GETS; i++){
+      hits += csa_get(s, (int)(xorshift(&seed) % SNAP_SPAN), &n);
+   }
+   assert(hits > 0);
+   return (now() - t) * 1e9 / SNAP_GETS;
+}
+
+// Bytes c doesn't share with anything
+size_t ownBytes(csa* c)
+{
+   struct csa_stats st;
+   assert(csa_stats(c, &st));
+   return st.bytes - st.shared;
+}
+
+// Taking a snapshot, reading it alone & while another thread writes to the
+// CSA, and what the copies made by those writes cost
+void snapshot(void)
+{
+   uint64_t seed = 88172645463325252ull;
+   csa* c = csa_init();
+   for(int i=0; i<SNAP_N; i++){
+      assert(csa_set(c, (int)(xorshift(&seed) % SNAP_SPAN), i));
+   }
+   // The first one has to count each block as shared
+   for(int r=0; r<2; r++){
+      double t = now();
+      csa* s = csa_snapshot(c);
+      t = now() - t;
+      assert(s);
+      printf("snapshot: %s %d blocks in %.2f ms (%.1f ns/block)\n", r ? "again" : "first", c->n, t * 1e3, t * 1e9 / c->n);
+      csa_free(&s);
+   }
+   csa* s = csa_snapshot(c);
+   assert(s);
+   printf("snapshot: reads alone %.1f ns/get\n", snapReads(s));
+   writeJob w = {.c = c};
+   pthread_t th;
+   assert(pthread_create(&th, NULL, writer, &w)==0);
+   double ns = snapReads(s);
+   __atomic_store_n(&w.stop, 1, __ATOMIC_RELEASE);
+   assert(pthread_join(th, NULL)==0);
+   printf("snapshot: reads with a writer %.1f ns/get (%ld writes meanwhile)\n", ns, w.writes);
+   csa_free(&s);
+   // The snapshot ends up holding the old version of every block written to
+   size_t live = ownBytes(c);
+   for(int writes=0; writes<=SNAP_N/8; writes=writes ? writes*8 : SNAP_N/512){
+      s = csa_snapshot(c);
+      assert(s);
+      for(int i=0; i<writes; i++){
+         assert(csa_set(c, (int)(xorshift(&seed) % SNAP_SPAN), i));
+      }
+      printf("snapshot: after %7d writes it holds %9zu bytes of its own (%5.1f%% of the CSA's %zu)\n",
+             writes, ownBytes(s), 100.0 * ownBytes(s) / live, live);
+      csa_free(&s);
+   }
+   csa_free(&c);
+}
+
+int cmpdouble(const void* a, const void* b)
+{
+   return (*(const double*)a > *(const double*)b) - (*(const double*)a < *(const double*)b);
+}
+
+// Median & best ns/op of every case. With a CSV file, a row per case is added
+// to it (with the header, if it's new), so runs of different versions line up.
+int suite(const char* csv, const char* label)
+{
+   FILE* out = NULL;
+   if(csv){
+      FILE* old = fopen(csv, "r");
+      bool fresh = (old == NULL);
+      if(old){
+         fclose(old);
+      }
+      if(!(out = fopen(csv, "a"))){
+         fprintf(stderr, "Can't write %s\n", csv);
+         return EXIT_FAILURE;
+      }
+      if(fresh){
+         fprintf(out, "label,workload,ops,median_ns_per_op,min_ns_per_op,reps\n");
+      }
+   }
+   printf("%-12s %10s %14s %14s\n", "workload", "ops", "median ns/op", "min ns/op");
+   for(int i=0; i<NUMCASES; i++){
+      double secs, ns[SUITE_REPS];
+      long ops = 0;
+      for(int w=0; w<SUITE_WARMUP; w++){
+         cases[i].run(&secs);
+      }
+      for(int r=0; r<SUITE_REPS; r++){
+         ops = cases[i].run(&secs);
+         ns[r] = secs * 1e9 / ops;
+      }
+      qsort(ns, SUITE_REPS, sizeof(double), cmpdouble);
+      printf("%-12s %10ld %14.2f %14.2f\n", cases[i].name, ops, ns[SUITE_REPS/2], ns[0]);
+      if(out){
+         fprintf(out, "%s,%s,%ld,%.3f,%.3f,%d\n", label, cases[i].name, ops, ns[SUITE_REPS/2], ns[0], SUITE_REPS);
+      }
+   }
+   if(out && fclose(out) != 0){
+      fprintf(stderr, "Can't write %s\n", csv);
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
+
+// csa_set of 0, 1, 2 ... as when building a table
+long seqfill(double* secs)
+{
+   csa* c = csa_init();
+   double t = now();
+   for(int i=0; i<SUITE_N; i++){
+      csa_set(c, i, i);
+   }
+   *secs = now() - t;
+   csa_free(&c);
+   return SUITE_N;
+}
+
+// csa_set at random, mostly one value per block - each new block shifts the directory, so fewer of them
+long sparsefill(double* secs)
+{
+   uint64_t seed = 88172645463325252ull;
+   csa* c = csa_init();
+   double t = now();
+   for(int i=0; i<SUITE_N/16; i++){
+      csa_set(c, (int)(xorshift(&seed) % SPARSE_SPAN), i);
+   }
+   *secs = now() - t;
+   csa_free(&c);
+   return SUITE_N/16;
+}
+
+// csa_get at random over a half-full array, hits & misses alike
+long randget(double* secs)
+{
+   uint64_t seed = 88172645463325252ull;
+   csa* c = csa_init();
+   for(int i=0; i<SUITE_N; i++){
+      if(xorshift(&seed) % 2){
+         csa_set(c, i, i);
+      }
+   }
+   int n;
+   long hits = 0;
+   double t = now();
+   for(int i=0; i<SUITE_N; i++){
+      hits += csa_get(c, (int)(xorshift(&seed) % SUITE_N), &n);
+   }
+   *secs = now() - t;
+   assert(hits > 0);
+   csa_free(&c);
+   return SUITE_N;
+}
+
+// Overwriting the same few keys, spread over separate blocks, again & again
+long hotkey(double* secs)
+{
+   uint64_t seed = 88172645463325252ull;
+   csa* c = csa_init();
+   double t = now();
+   for(int i=0; i<SUITE_N; i++){
+      csa_set(c, (int)(xorshift(&seed) % HOT_KEYS) * 1000, i);
+   }
+   *secs = now() - t;
+   csa_free(&c);
+   return SUITE_N;
+}
+
+// Equal numbers of sets & deletes at random, so blocks keep emptying & coming back
+long churn(double* secs)
+{
+   uint64_t seed = 88172645463325252ull;
+   csa* c = csa_init();
+   double t = now();
+   for(int i=0; i<SUITE_N; i++){
+      int idx = (int)(xorshift(&seed) % CHURN_SPAN);
+      if(i%2){
+         csa_delete(c, idx);
+      }
+      else{
+         csa_set(c, idx, i);
+      }
+   }
+   *secs = now() - t;
+   csa_free(&c);
+   return SUITE_N;
+}
+
+// csa_foreach over every value of a 7/8 full array
+long scan(double* secs)
+{
+   csa* c = csa_init();
+   for(int i=0; i<SUITE_N; i++){
+      if(i%8){
+         csa_set(c, i, i%1000);
+      }
+   }
+   int acc = 0;
+   double t = now();
+   csa_foreach(sum, c, &acc);
+   *secs = now() - t;
+   csa_free(&c);
+   return SUITE_N - SUITE_N/8;
+}
+
+// The sieve of Eratosthenes as in sieve.c, up to SIEVE_MAX : every index set, then
+// multiples deleted. Counts the deletes & csa_next() steps as the operations.
+long sieve(double* secs)
+{
+   int* ones = (int*)malloc(SIEVE_MAX * sizeof(int));
+   assert(ones);
+   for(int i=0; i<SIEVE_MAX; i++){
+      ones[i] = 1;
+   }
+   csa* c = csa_init();
+   long ops = 0;
+   double t = now();
+   assert(csa_set_range(c, 2, ones, SIEVE_MAX - 1));
+   for(int p=2; (long)p*p<=SIEVE_MAX && csa_next(c, p, &p, NULL); p++){
+      ops++;
+      for(int m=p*p; m<=SIEVE_MAX; m+=p){
+         csa_delete(c, m);
+         ops++;
+      }
+   }
+   *secs = now() - t;
+   assert(csa_range_count(c, 0, SIEVE_MAX + 1)==664579);
+   csa_free(&c);
+   free(ones);
+   return ops;
+}
@@ -0,0 +1,140 @@
+// How csa_mt scales with threads : readers only, writers only, then a 90/10 mix.
+// Usage : ./csabench_mt [maxthreads]   (default : every online core)
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <unistd.h>
+#include "csa_mt.h"
+
+// Dense enough that threads keep meeting in the same blocks
+#define RANGE   (MSKLEN*4096)
+#define PREFILL 4
+#define SECONDS 0.5
+
+typedef struct {
+   const char* name;
+   // Out of 100, how many operations are writes
+   int writes;
+} mix;
+
+struct worker {
+   csa_mt* c;
+   int writes;
+   uint64_t seed;
+   bool* stop;
+   long ops;
+};
+
+double now(void);
+uint64_t xorshift(uint64_t* s);
+void* work(void* arg);
+double run(csa_mt* c, int threads, int writes);
+
+static const mix mixes[] = {
+   {"read", 0},
+   {"write", 100},
+   {"mixed", 10}
+};
+#define NUMMIXES (int)(sizeof(mixes) / sizeof(mixes[0]))
+
+int main(int argc, char* argv[])
+{
+   int maxthreads = (argc > 1) ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+   if(maxthreads < 1){
+      fprintf(stderr, "Usage : %s [maxthreads]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   csa_mt* c = csa_mt_init();
+   for(int i=0; i<RANGE; i+=PREFILL){
+      assert(csa_mt_set(c, i, i));
+   }
+   printf("%-6s %8s %14s %8s\n", "load", "threads", "ops/sec", "speedup");
+   for(int m=0; m<NUMMIXES; m++){
+      double base = 0.0;
+      for(int t=1; t<=maxthreads; t*=2){
+         double rate = run(c, t, mixes[m].writes);
+         if(t==1){
+            base = rate;
+         }
+         printf("%-6s %8d %14.0f %7.2fx\n", mixes[m].name, t, rate, rate / base);
+         // Always finish on the full count, even if it isn't a power of 2
+         if(t < maxthreads && t*2 > maxthreads){
+            t = maxthreads / 2;
+         }
+      }
+   }
+   csa_mt_free(&c);
+   return EXIT_SUCCESS;
+}
+
+// Wall-clock seconds
+double now(void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+uint64_t xorshift(uint64_t* s)
+{
+   *s ^= *s << 13;
+   *s ^= *s >> 7;
+   *s ^= *s << 17;
+   return *s;
+}
+
+// Writes set or delete at random, so blocks come & go and the directory changes too
+void* work(void* arg)
+{
+   struct worker* w = (struct worker*)arg;
+   int n;
+   long ops = 0;
+   while(!__atomic_load_n(w->stop, __ATOMIC_RELAXED)){
+      for(int i=0; i<1024; i++){
+         uint64_t r = xorshift(&w->seed);
+         int idx = (int)((r >> 8) % RANGE);
+         if((int)(r % 100) < w->writes){
+            if(r & 128){
+               csa_mt_set(w->c, idx, idx);
+            }
+            else{
+               csa_mt_delete(w->c, idx);
+            }
+         }
+         else{
+            csa_mt_get(w->c, idx, &n);
+         }
+      }
+      ops += 1024;
+   }
+   w->ops = ops;
+   return NULL;
+}
+
+// Operations per second over all threads
+double run(csa_mt* c, int threads, int writes)
+{
+   pthread_t* t = (pthread_t*)calloc(threads, sizeof(pthread_t));
+   struct worker* w = (struct worker*)calloc(threads, sizeof(struct worker));
+   assert(t && w);
+   bool stop = false;
+   double start = now();
+   for(int i=0; i<threads; i++){
+      w[i].c = c;
+      w[i].writes = writes;
+      w[i].seed = 88172645463325252ull + (uint64_t)i * 7919;
+      w[i].stop = &stop;
+      assert(pthread_create(&t[i], NULL, work, &w[i])==0);
+   }
+   struct timespec nap = {0, (long)(SECONDS * 1e9)};
+   nanosleep(&nap, NULL);
+   __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+   long ops = 0;
+   for(int i=0; i<threads; i++){
+      assert(pthread_join(t[i], NULL)==0);
+      ops += w[i].ops;
+   }
+   double rate = (double)ops / (now() - start);
+   free(t);
+   free(w);
+   return rate;
+}
@@ -1,51 +1,858 @@
 #include "csa.h"
 #include "mydefs.h"
 
-csa* csa_init(void) { return (csa*)calloc(1, sizeof(csa)); }
+csa* csa_init(void) { return csa_init_policy(csa_balanced); }
 
-bool csa_get(csa* c, int idx, int* val) { return ((c->n == 0) ? false : (c->b[getBlockIndex(c, idx)].offset > (unsigned int)(idx/(int)MSKLEN) * MSKLEN) ? false : (getVal(&(c->b[getBlockIndex(c, idx)]), idx % MSKLEN, val))); }
+csa* csa_init_policy(csa_policy p) {
+  csa* c = (csa*)calloc(1, sizeof(csa));
+  if (c) c->policy = p;
+  return c;
+}
+
+void csa_arena_init(csa_arena* a, void* buf, size_t size) {
+  if (a) *a = (csa_arena){.base = (unsigned char*)buf, .size = buf ? size : 0};
+}
+
+void csa_arena_reset(csa_arena* a) {
+  if (a) a->used = a->last = 0;
+}
+
+csa* csa_init_arena(csa_arena* a) {
+  csa* c = a ? (csa*)arenaAlloc(a, sizeof(csa)) : NULL;
+  if (c) *c = (csa){.policy = csa_balanced, .arena = a};
+  return c;
+}
+
+void* arenaAlloc(csa_arena* a, size_t size) {
+  uintptr_t at = ((uintptr_t)(a->base + a->used) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+  size_t start = at - (uintptr_t)a->base;
+  if (start > a->size || size > a->size - start) return NULL;
+  a->last = start;
+  a->used = start + size;
+  return a->base + start;
+}
+
+void* csaAlloc(csa* c, size_t size) { return c->arena ? arenaAlloc(c->arena, size) : malloc(size); }
+
+// Only an arena's latest allocation can change size where it is - anything else is copied to a new one
+void* csaRealloc(csa* c, void* p, size_t old, size_t size) {
+  csa_arena* a = c->arena;
+  if (!a) return realloc(p, size);
+  if (p && (unsigned char*)p == a->base + a->last && size <= a->size - a->last) {
+    a->used = a->last + size;
+    return p;
+  }
+  if (p && size <= old) return p;
+  void* temp = arenaAlloc(a, size);
+  if (temp && p) memcpy(temp, p, old);
+  return temp;
+}
+
+// An arena takes back its latest allocation only
+void csaRelease(csa* c, void* p) {
+  if (!c->arena) free(p);
+  else if (p && (unsigned char*)p == c->arena->base + c->arena->last) c->arena->used = c->arena->last;
+}
+
+bool isShared(int* refs) { return refs && __atomic_load_n(refs, __ATOMIC_ACQUIRE) > 1; }
+
+// Lets go of a vals array, which is only freed once no other CSA holds it either
+void dropVals(csa* c, int* vals, int* refs) {
+  if (refs && __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+  csaRelease(c, refs);
+  csaRelease(c, vals);
+}
+
+// Makes b's values c's alone before they change, copying them if a snapshot still holds them.
+// If none does any more, c just takes them back.
+bool ownBlock(csa* c, block* b) {
+  if (!b->refs) return true;
+  if (__atomic_load_n(b->refs, __ATOMIC_ACQUIRE) > 1) {
+    int* vals = (int*)csaAlloc(c, b->cap * sizeof(int));
+    if (!vals) return false;
+    memcpy(vals, b->vals, __builtin_popcountll(b->msk) * sizeof(int));
+    dropVals(c, b->vals, b->refs);
+    b->vals = vals;
+  }
+  else csaRelease(c, b->refs);
+  b->refs = NULL;
+  return true;
+}
+
+// As ownBlock, for all of segment s. Other pieces of c split from the same array only count as
+// sharing it with each other, so it stays shared between them.
+bool ownSegment(csa* c, int s) {
+  segment* g = &(c->dense[s]);
+  if (!g->refs) return true;
+  if (segmentShared(c, s)) {
+    int* vals = (int*)csaAlloc(c, (size_t)g->cap * MSKLEN * sizeof(int));
+    if (!vals) return false;
+    memcpy(vals, g->vals, (size_t)g->blocks * MSKLEN * sizeof(int));
+    int first = getBlockIndex(c, g->offset);
+    for (int k = 0; k < g->blocks; k++) c->b[first + k].vals = vals + (size_t)k * MSKLEN;
+    dropVals(c, segmentArray(g), g->refs);
+    g->vals = vals;
+    g->base = NULL;
+  }
+  else if (isShared(g->refs)) return true;
+  else csaRelease(c, g->refs);
+  g->refs = NULL;
+  return true;
+}
+
+// Whether anything besides c's own segments holds s's array
+bool segmentShared(csa* c, int s) {
+  int* refs = c->dense[s].refs;
+  if (!isShared(refs)) return false;
+  int mine = 0;
+  for (int t = 0; t < c->ndense; t++) mine += (c->dense[t].refs == refs);
+  return __atomic_load_n(refs, __ATOMIC_ACQUIRE) > mine;
+}
+
+// Readies block blk for writing. A full block may be part of a segment : if a snapshot holds that
+// too, just this block is split off & copied, rather than the whole segment.
+bool ownAt(csa* c, int blk) {
+  int s = (c->ndense && c->b[blk].msk == ~0ull) ? segmentAt(c, c->b[blk].offset) : -1;
+  if (s < 0) return ownBlock(c, &(c->b[blk]));
+  return segmentShared(c, s) ? splitSegment(c, s, blk) : ownSegment(c, s);
+}
+
+// Whole segments first, rather than splitting every block off them
+bool ownAll(csa* c) {
+  bool ok = true;
+  for (int s = 0; s < c->ndense; s++) ok = ok && ownSegment(c, s);
+  for (int blk = 0; blk < c->n; blk++) ok = ok && ownAt(c, blk);
+  return ok;
+}
+
+// Counts one more holder of an array, first counting c as one if it had it alone
+bool shareVals(csa* c, int** refs) {
+  if (!*refs && (*refs = (int*)csaAlloc(c, sizeof(int)))) **refs = 1;
+  return *refs != NULL;
+}
+
+csa* csa_snapshot(csa* c) {
+  if (!c || c->map) return NULL;
+  csa* s = c->arena ? csa_init_arena(c->arena) : csa_init_policy(c->policy);
+  bool ok = s && !(c->n && !(s->b = (block*)csaAlloc(s, c->n * sizeof(block))));
+  ok = ok && !(c->ndense && !(s->dense = (segment*)csaAlloc(s, c->ndense * sizeof(segment))));
+  // Counters first, so running out of memory leaves no array counted twice
+  for (int g = 0; g < c->ndense; g++) ok = ok && shareVals(c, &(c->dense[g].refs));
+  for (int blk = 0; blk < c->n; blk++) ok = ok && (segmentAt(c, c->b[blk].offset) >= 0 || shareVals(c, &(c->b[blk].refs)));
+  if (!ok) {
+    csa_free(&s);
+    return NULL;
+  }
+  for (int g = 0; g < c->ndense; g++) __atomic_add_fetch(c->dense[g].refs, 1, __ATOMIC_RELAXED);
+  for (int blk = 0; blk < c->n; blk++) if (c->b[blk].refs) __atomic_add_fetch(c->b[blk].refs, 1, __ATOMIC_RELAXED);
+  if (c->n) memcpy(s->b, c->b, c->n * sizeof(block));
+  if (c->ndense) memcpy(s->dense, c->dense, c->ndense * sizeof(segment));
+  s->n = s->cap = c->n;
+  s->ndense = c->ndense;
+  s->policy = c->policy;
+  s->frozen = true;
+  return s;
+}
+
+bool csa_get(csa* c, int idx, int* val) {
+  if (!c || !val || idx < 0) return false;
+  CSA_STAT(c, gets, 1);
+  // Inside a dense segment it's a plain array lookup
+  int s = c->ndense ? segmentAt(c, idx) : -1;
+  if (s >= 0) return ((*val = c->dense[s].vals[idx - c->dense[s].offset]) || true);
+  block view;
+  int blk = lookupBlock(c, idx);
+  return (blk < c->n) && (offsetAt(c, blk) == blockOffset(idx)) && getVal(blockAt(c, blk, &view), idx % MSKLEN, val);
+}
 
-int getBlockIndex(csa* c, int idx) {
+unsigned int offsetAt(csa* c, int blk) { return c->map ? c->map->dir[blk].offset : c->b[blk].offset; }
+
+// Block blk of c. A mapped CSA has no block structs, so one is made up in *view instead
+block* blockAt(csa* c, int blk, block* view) {
+  if (!c->map) return &(c->b[blk]);
+  const csaFileBlock* f = &(c->map->dir[blk]);
+  *view = (block){.vals = (int*)(c->map->vals + f->start), .msk = f->msk, .offset = f->offset, .cap = __builtin_popcountll(f->msk)};
+  return view;
+}
+
+unsigned int blockOffset(int idx) { return (unsigned int)(idx / MSKLEN) * MSKLEN; }
+
+// Index of the first block whose offset is not below idx's block, or c->n if there is none.
+// Only the lookups of csa_get/set/delete are counted, so probes per lookup means what it says.
+static int searchBlocks(csa* c, int idx, bool counted) {
+#ifdef LINEAR_SCAN
   int blockIndex = 0;
-  while (blockIndex < c->n && c->b[blockIndex].offset < (unsigned int)(idx/(int)MSKLEN) * MSKLEN) blockIndex++;
+  while (blockIndex < c->n && offsetAt(c, blockIndex) < blockOffset(idx)) {
+    if (counted) CSA_STAT(c, probes, 1);
+    blockIndex++;
+  }
   return blockIndex;
+#else
+  int lo = 0, hi = c->n;
+  while (lo < hi) {
+    int mid = lo + ((hi - lo) >> 1);
+    if (counted) CSA_STAT(c, probes, 1);
+    if (offsetAt(c, mid) < blockOffset(idx)) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+#endif
 }
 
+int getBlockIndex(csa* c, int idx) { return searchBlocks(c, idx, false); }
+
+int lookupBlock(csa* c, int idx) { return searchBlocks(c, idx, true); }
+
 bool getVal(block* b, int idx, int* val) { return ((b->msk & (1ull << idx)) == 0) ? false : ((*val = b->vals[getValIndex(b, idx)]) || true); }
 
 int getValIndex(block* b, int idx) { return __builtin_popcountl(b->msk & ((1ull << idx) - 1)); }
 
-bool csa_set(csa* c, int idx, int val) { return ((c->n == 0) ? addNewBlock(c, idx, val) : ((getBlockIndex(c, idx) == c->n) || (c->b[getBlockIndex(c, idx)].offset > (unsigned int)(idx/(int)MSKLEN) * MSKLEN)) ? addNewBlock(c, idx, val) : (addValToBlock(&(c->b[getBlockIndex(c, idx)]), idx % MSKLEN, val))); }
+bool csa_set(csa* c, int idx, int val) {
+  if (!c || idx < 0 || c->frozen) return false;
+  CSA_STAT(c, sets, 1);
+  int blk = lookupBlock(c, idx);
+  if ((blk == c->n) || (c->b[blk].offset != blockOffset(idx))) return addNewBlock(c, blk, idx, val);
+  if (!ownAt(c, blk) || !addValToBlock(c, &(c->b[blk]), idx % MSKLEN, val)) return false;
+  if (c->b[blk].msk == ~0ull) promote(c, blk);
+  return true;
+}
 
-int offsets(const void* b1, const void* b2) { return ((block*)b2)->offset - ((block*)b1)->offset; }
+// Index of the segment holding idx, or -1
+int segmentAt(csa* c, int idx) {
+  int lo = 0, hi = c->ndense;
+  while (lo < hi) {
+    int mid = lo + ((hi - lo) >> 1);
+    if (c->dense[mid].offset + (unsigned int)c->dense[mid].blocks * MSKLEN <= (unsigned int)idx) lo = mid + 1;
+    else hi = mid;
+  }
+  return (lo < c->ndense && c->dense[lo].offset <= (unsigned int)idx) ? lo : -1;
+}
 
-bool addNewBlock(csa* c, int idx, int val) {
-  if (!(c->b = (block*)realloc(c->b, (c->n + 1) * sizeof(block))) || !(c->b[c->n].vals = (int*)malloc(sizeof(int)))) return false;
-  *(c->b[c->n].vals) = val;
-  c->b[c->n].msk = 1ull << (idx % MSKLEN);
-  return (c->b[(c->n)++].offset = (idx / MSKLEN) * MSKLEN) || true;
+// Gathers full, back-to-back blocks into segments once blk fills up : it joins the end of a segment
+// just before it, or starts a new one if it's part of a run of at least DENSE_MIN loose full blocks.
+// A segment that runs into the next one is left at that : joining them would copy the next one, &
+// deleting & setting a cell at the join would copy it again every time. Running out of memory just
+// leaves the blocks as they were.
+void promote(csa* c, int blk) {
+  if (segmentAt(c, c->b[blk].offset) >= 0) return;
+  int s = (blk > 0 && c->b[blk - 1].offset + MSKLEN == c->b[blk].offset) ? segmentAt(c, c->b[blk - 1].offset) : -1;
+  if (s < 0) {
+    int lo = blk, hi = blk + 1;
+    while (lo > 0 && c->b[lo - 1].msk == ~0ull && c->b[lo - 1].offset + MSKLEN == c->b[lo].offset && segmentAt(c, c->b[lo - 1].offset) < 0) lo--;
+    while (hi < c->n && c->b[hi].msk == ~0ull && c->b[hi].offset == c->b[hi - 1].offset + MSKLEN && segmentAt(c, c->b[hi].offset) < 0) hi++;
+    if (hi - lo < DENSE_MIN) return;
+    segment* temp = (segment*)csaRealloc(c, c->dense, c->ndense * sizeof(segment), (c->ndense + 1) * sizeof(segment));
+    CSA_STAT(c, reallocs, 1);
+    if (!temp) return;
+    c->dense = temp;
+    for (s = 0; s < c->ndense && c->dense[s].offset < c->b[lo].offset; s++);
+    memmove(c->dense + s + 1, c->dense + s, (c->ndense - s) * sizeof(segment));
+    c->ndense++;
+    c->dense[s] = (segment){.offset = c->b[lo].offset};
+    for (blk = lo; blk < hi; blk++) {
+      if (appendToSegment(c, s, blk)) continue;
+      // Couldn't even start it
+      if (c->dense[s].blocks == 0) demote(c, s);
+      return;
+    }
+  }
+  // Growing a segment a snapshot still holds would copy all of it
+  else if (!segmentShared(c, s)) appendToSegment(c, s, blk);
 }
 
-bool addValToBlock(block* b, int idx, int val) {
-  if (b->msk & (1ull << idx)) return ((b->vals[getValIndex(b, idx)] = val) || true);
+// Makes room in segment s (whose first block is at first) for at least `blocks` blocks, doubling as
+// it goes so a segment growing a block at a time is only copied O(log n) times
+bool growSegment(csa* c, int s, int first, int blocks) {
+  segment* g = &(c->dense[s]);
+  if (blocks <= g->cap) return true;
+  if (!ownSegment(c, s)) return false;
+  int cap = g->cap ? g->cap : DENSE_MIN;
+  while (cap < blocks) cap *= 2;
+  // Partway into an array, or sharing it with other pieces, it can't be realloc()'d, so it moves
+  bool moves = g->base || g->refs;
+  int* temp = moves ? (int*)csaAlloc(c, (size_t)cap * MSKLEN * sizeof(int))
+                    : (int*)csaRealloc(c, g->vals, (size_t)g->cap * MSKLEN * sizeof(int), (size_t)cap * MSKLEN * sizeof(int));
+  CSA_STAT(c, reallocs, 1);
+  if (!temp) return false;
+  if (moves) {
+    memcpy(temp, g->vals, (size_t)g->blocks * MSKLEN * sizeof(int));
+    dropVals(c, segmentArray(g), g->refs);
+    g->base = NULL;
+    g->refs = NULL;
+  }
+  // The array may have moved
+  for (int k = 0; k < g->blocks; k++) c->b[first + k].vals = temp + (size_t)k * MSKLEN;
+  g->vals = temp;
+  g->cap = cap;
+  return true;
+}
+
+// Moves block blk's values onto the end of segment s, which it directly follows
+bool appendToSegment(csa* c, int s, int blk) {
+  segment* g = &(c->dense[s]);
+  if (!growSegment(c, s, blk - g->blocks, g->blocks + 1)) return false;
+  int* slot = g->vals + (size_t)g->blocks * MSKLEN;
+  memcpy(slot, c->b[blk].vals, MSKLEN * sizeof(int));
+  dropVals(c, c->b[blk].vals, c->b[blk].refs);
+  c->b[blk].vals = slot;
+  c->b[blk].refs = NULL;
+  c->b[blk].cap = MSKLEN;
+  g->blocks++;
+  return true;
+}
+
+// Gives each block of segment s its own values again, before one of them loses a value. It works
+// back from the end, & an array c has to itself is shrunk every DEMOTE_STEP blocks, so a big
+// segment's values are never held twice over. Running out of memory leaves the blocks not yet
+// done as a shorter segment.
+bool demote(csa* c, int s) {
+  segment* g = &(c->dense[s]);
+  int first = getBlockIndex(c, g->offset);
+  bool shrinks = !g->base && !isShared(g->refs);
+  while (g->blocks) {
+    int* vals = (int*)csaAlloc(c, MSKLEN * sizeof(int));
+    if (!vals) return false;
+    block* b = &(c->b[first + --(g->blocks)]);
+    memcpy(vals, b->vals, MSKLEN * sizeof(int));
+    b->vals = vals;
+    if (!shrinks || !g->blocks || g->cap - g->blocks < DEMOTE_STEP) continue;
+    int* temp = (int*)csaRealloc(c, g->vals, (size_t)g->cap * MSKLEN * sizeof(int), (size_t)g->blocks * MSKLEN * sizeof(int));
+    CSA_STAT(c, reallocs, 1);
+    if (!temp) continue;
+    // The array may have moved
+    for (int k = 0; k < g->blocks; k++) c->b[first + k].vals = temp + (size_t)k * MSKLEN;
+    g->vals = temp;
+    g->cap = g->blocks;
+  }
+  dropVals(c, segmentArray(g), g->refs);
+  memmove(c->dense + s, c->dense + s + 1, (c->ndense - s - 1) * sizeof(segment));
+  if (--(c->ndense) == 0) {
+    csaRelease(c, c->dense);
+    c->dense = NULL;
+  }
+  return true;
+}
+
+// Takes block blk out of segment s, giving it its own copy of its values. The blocks before & after
+// it become two segments : the bigger side keeps the array & the smaller one is copied out, unless
+// a snapshot (or another piece) still holds the array, when both just point into it. A side left
+// with fewer than DENSE_MIN blocks goes back to loose blocks. Running out of memory leaves
+// everything as it was.
+bool splitSegment(csa* c, int s, int blk) {
+  segment* g = &(c->dense[s]);
+  int first = getBlockIndex(c, g->offset), k = blk - first, rest = g->blocks - k - 1;
+  bool shared = isShared(g->refs);
+  int* vals = (int*)csaAlloc(c, MSKLEN * sizeof(int));
+  int* copy = NULL;
+  if (!vals) return false;
+  if (k && rest) {
+    segment* temp = (segment*)csaRealloc(c, c->dense, c->ndense * sizeof(segment), (c->ndense + 1) * sizeof(segment));
+    CSA_STAT(c, reallocs, 1);
+    if (temp) c->dense = temp;
+    if (temp && !shared) copy = (int*)csaAlloc(c, (size_t)(k < rest ? k : rest) * MSKLEN * sizeof(int));
+    if (!temp || (!shared && !copy)) {
+      csaRelease(c, vals);
+      return false;
+    }
+    g = &(c->dense[s]);
+  }
+  memcpy(vals, c->b[blk].vals, MSKLEN * sizeof(int));
+  c->b[blk].vals = vals;
+  // A shared array's spare room may be where blk was, which a snapshot still reads
+  segment after = {.vals = g->vals + (size_t)(k + 1) * MSKLEN, .base = segmentArray(g), .offset = c->b[blk].offset + MSKLEN,
+                   .blocks = rest, .cap = shared ? rest : g->cap - k - 1, .refs = g->refs};
+  g->blocks = k;
+  if (shared) g->cap = k;
+  if (k && rest) {
+    if (shared) __atomic_add_fetch(g->refs, 1, __ATOMIC_RELAXED);
+    else if (k <= rest) {
+      memcpy(copy, g->vals, (size_t)k * MSKLEN * sizeof(int));
+      for (int j = 0; j < k; j++) c->b[first + j].vals = copy + (size_t)j * MSKLEN;
+      *g = (segment){.vals = copy, .offset = g->offset, .blocks = k, .cap = k};
+    }
+    else {
+      memcpy(copy, after.vals, (size_t)rest * MSKLEN * sizeof(int));
+      for (int j = 0; j < rest; j++) c->b[blk + 1 + j].vals = copy + (size_t)j * MSKLEN;
+      after = (segment){.vals = copy, .offset = after.offset, .blocks = rest, .cap = rest};
+    }
+    memmove(c->dense + s + 2, c->dense + s + 1, (c->ndense - s - 1) * sizeof(segment));
+    c->ndense++;
+    c->dense[s + 1] = after;
+  }
+  else if (rest) *g = after;
+  // Either side may be too short to keep, or empty - demoting an empty segment just drops it
+  if (k && rest && rest < DENSE_MIN) demote(c, s + 1);
+  if (c->dense[s].blocks < DENSE_MIN) demote(c, s);
+  return true;
+}
 
-  int* temp = (int*)malloc(sizeof(int) * (__builtin_popcountl(b->msk) + 1));
+int* segmentArray(segment* g) { return g->base ? g->base : g->vals; }
+
+// Opens a new block at position blk, keeping the directory ordered by offset
+bool addNewBlock(csa* c, int blk, int idx, int val) {
+  if (c->n == c->cap && !resizeBlocks(c, c->cap ? c->cap * 2 : 1)) return false;
+  unsigned int cap = valCapacity(c->policy, 0, 1);
+  int* vals = (int*)csaAlloc(c, cap * sizeof(int));
+  if (!vals) return false;
+  memmove(c->b + blk + 1, c->b + blk, (c->n - blk) * sizeof(block));
+  *vals = val;
+  c->b[blk] = (block){.vals = vals, .msk = 1ull << (idx % MSKLEN), .offset = blockOffset(idx), .cap = cap};
+  return ++(c->n);
+}
+
+// Moves the directory to an array of cap blocks
+bool resizeBlocks(csa* c, int cap) {
+  block* temp = (block*)csaRealloc(c, c->b, (size_t)c->cap * sizeof(block), cap * sizeof(block));
+  CSA_STAT(c, reallocs, 1);
   if (!temp) return false;
-  
-  memcpy(temp, b->vals, getValIndex(b, idx) * sizeof(int));
-  temp[getValIndex(b, idx)] = val;
-  memcpy(temp + getValIndex(b, idx) + 1, b->vals + getValIndex(b, idx), (__builtin_popcountl(b->msk) - getValIndex(b, idx)) * sizeof(int));
+  c->b = temp;
+  c->cap = cap;
+  return true;
+}
 
-  free(b->vals);
-  b->vals = temp;
+// How many value slots a block should have room for, given it needs at least `need`
+unsigned int valCapacity(csa_policy p, unsigned int cap, unsigned int need) {
+  if (p == csa_fast) return MSKLEN;
+  if (p == csa_compact) return need;
+  if (cap == 0) cap = 1;
+  while (cap < need) cap <<= 1;
+  return (cap > MSKLEN) ? MSKLEN : cap;
+}
+
+bool addValToBlock(csa* c, block* b, int idx, int val) {
+  int valIndex = getValIndex(b, idx);
+  if (b->msk & (1ull << idx)) return ((b->vals[valIndex] = val) || true);
+
+  unsigned int count = __builtin_popcountl(b->msk);
+  if (count == b->cap) {
+    unsigned int cap = valCapacity(c->policy, b->cap, count + 1);
+    int* temp = (int*)csaRealloc(c, b->vals, b->cap * sizeof(int), cap * sizeof(int));
+    CSA_STAT(c, reallocs, 1);
+    if (!temp) return false;
+    b->vals = temp;
+    b->cap = cap;
+  }
+  memmove(b->vals + valIndex + 1, b->vals + valIndex, (count - valIndex) * sizeof(int));
+  b->vals[valIndex] = val;
   return (b->msk |= 1ull << idx) || true;
 }
 
+// Gives back spare slots after a delete - never fails, the old array is kept if realloc() does.
+// An array a snapshot still holds is left alone.
+void shrinkVals(csa* c, block* b) {
+  unsigned int count = __builtin_popcountl(b->msk);
+  unsigned int cap = b->cap;
+  if (count == 0 || c->policy == csa_fast || isShared(b->refs)) return;
+  if (c->policy == csa_compact) cap = count;
+  else if (count <= b->cap / 4) cap = b->cap / 2;
+  if (cap == b->cap) return;
+  int* temp = (int*)csaRealloc(c, b->vals, b->cap * sizeof(int), cap * sizeof(int));
+  CSA_STAT(c, reallocs, 1);
+  if (!temp) return;
+  b->vals = temp;
+  b->cap = cap;
+}
+
+bool csa_set_many(csa* c, const int* idx, const int* val, int n) {
+  if (!c || c->frozen || n < 0 || (n > 0 && (!idx || !val))) return false;
+  for (int i = 0; i < n; i++) {
+    if (idx[i] < 0 || (i > 0 && idx[i] < idx[i - 1])) {
+      // Not sorted - no single pass is possible, so fall back to one set at a time
+      bool ok = true;
+      for (int j = 0; j < n; j++) ok &= csa_set(c, idx[j], val[j]);
+      return ok;
+    }
+  }
+  // Counted here only on this path - csa_set() counts the fallback's
+  CSA_STAT(c, sets, n);
+  return mergeSorted(c, idx, 0, val, n);
+}
+
+bool csa_set_range(csa* c, int lo, const int* vals, int n) {
+  if (!c || c->frozen || lo < 0 || n < 0 || (n > 0 && !vals) || n > INT_MAX - lo) return false;
+  CSA_STAT(c, sets, n);
+  return mergeSorted(c, NULL, lo, vals, n);
+}
+
+int sortedIndex(const int* idx, int lo, int i) { return idx ? idx[i] : lo + i; }
+
+// Merges n sorted indices (idx[i], or lo + i when idx is NULL) into a new directory in one pass
+bool mergeSorted(csa* c, const int* idx, int lo, const int* val, int n) {
+  int fresh = 0;
+  for (int i = 0, j = 0; i < n; ) {
+    unsigned int off = blockOffset(sortedIndex(idx, lo, i));
+    while (i < n && blockOffset(sortedIndex(idx, lo, i)) == off) i++;
+    while (j < c->n && c->b[j].offset < off) j++;
+    bool found = j < c->n && c->b[j].offset == off;
+    // Blocks about to change mustn't still be shared with a snapshot
+    if (found && !ownAt(c, j)) return false;
+    fresh += !found;
+  }
+  if (n == 0) return true;
+
+  int cap = (c->n + fresh > c->cap) ? c->n + fresh : c->cap;
+  block* nb = (block*)csaAlloc(c, cap * sizeof(block));
+  if (!nb) return false;
+  bool ok = true;
+  int w = 0, j = 0;
+  for (int i = 0; i < n; ) {
+    unsigned int off = blockOffset(sortedIndex(idx, lo, i));
+    while (j < c->n && c->b[j].offset < off) nb[w++] = c->b[j++];
+    int slot[MSKLEN];
+    mask_t msk = 0;
+    for (; i < n && blockOffset(sortedIndex(idx, lo, i)) == off; i++) {
+      int bit = sortedIndex(idx, lo, i) % MSKLEN;
+      slot[bit] = val[i];
+      msk |= 1ull << bit;
+    }
+    nb[w] = (j < c->n && c->b[j].offset == off) ? c->b[j++] : (block){.offset = off};
+    // A fresh block that can't be allocated is left out, everything else still lands
+    if (!mergeIntoBlock(c, &nb[w], msk, slot)) ok = false;
+    if (nb[w].msk) w++;
+  }
+  while (j < c->n) nb[w++] = c->b[j++];
+  csaRelease(c, c->b);
+  c->b = nb;
+  c->n = w;
+  c->cap = cap;
+  for (int k = 0; k < c->n; k++) if (c->b[k].msk == ~0ull) promote(c, k);
+  return ok;
+}
+
+// Writes slot[bit] for every bit of msk into b, merging with what's already stored
+bool mergeIntoBlock(csa* c, block* b, mask_t msk, const int* slot) {
+  mask_t all = b->msk | msk;
+  unsigned int need = __builtin_popcountl(all);
+  if (need > b->cap) {
+    unsigned int cap = valCapacity(c->policy, b->cap, need);
+    int* temp = (int*)csaRealloc(c, b->vals, b->cap * sizeof(int), cap * sizeof(int));
+    CSA_STAT(c, reallocs, 1);
+    if (!temp) return false;
+    b->vals = temp;
+    b->cap = cap;
+  }
+  // Fill from the top down so old values are read before they can be overwritten
+  int from = __builtin_popcountl(b->msk) - 1;
+  int to = need - 1;
+  for (int bit = MSKLEN - 1; bit >= 0; bit--) {
+    if (!(all & (1ull << bit))) continue;
+    int v = (msk & (1ull << bit)) ? slot[bit] : b->vals[from];
+    if (b->msk & (1ull << bit)) from--;
+    b->vals[to--] = v;
+  }
+  b->msk = all;
+  return true;
+}
+
+int csa_export(csa* c, int from, int* idx, int* val, int max) {
+  if (!c || !idx || !val || max <= 0) return 0;
+  if (from < 0) from = 0;
+  int w = 0;
+  block view;
+  for (int blk = getBlockIndex(c, from); blk < c->n && w < max; blk++) {
+    block* b = blockAt(c, blk, &view);
+    mask_t m = b->msk;
+    if (b->offset == blockOffset(from)) m &= ~((1ull << (from % MSKLEN)) - 1);
+    for (int v = __builtin_popcountl(b->msk & ~m); m && w < max; v++, w++) {
+      idx[w] = b->offset + __builtin_ctzll(m);
+      val[w] = b->vals[v];
+      m &= m - 1;
+    }
+  }
+  return w;
+}
+
+// The set bits of b with indices in [lo, hi) - their values are the contiguous
+// run of b->vals starting at *first
+mask_t rangeBits(block* b, int lo, int hi, int* first) {
+  long long from = (long long)lo - b->offset, to = (long long)hi - b->offset;
+  if (from < 0) from = 0;
+  if (to > MSKLEN) to = MSKLEN;
+  mask_t m = (from >= to) ? 0 : (((to == MSKLEN) ? ~0ull : (1ull << to) - 1) & ~((1ull << from) - 1) & b->msk);
+  *first = m ? getValIndex(b, __builtin_ctzll(m)) : 0;
+  return m;
+}
+
+void csa_iter_init(csa_iter* it, csa* c, int lo, int hi) {
+  if (lo < 0) lo = 0;
+  // Parked just before the first candidate block, so the first csa_iter_next() loads it
+  *it = (csa_iter){.c = (lo < hi) ? c : NULL, .lo = lo, .hi = hi};
+  if (it->c) it->blk = getBlockIndex(c, lo) - 1;
+}
+
+bool csa_iter_next(csa_iter* it, int* idx, int* val) {
+  if (!it || !it->c) return false;
+  block view;
+  while (!it->m) {
+    if (++(it->blk) >= it->c->n || offsetAt(it->c, it->blk) >= (unsigned int)it->hi) {
+      it->c = NULL;
+      return false;
+    }
+    it->m = rangeBits(blockAt(it->c, it->blk, &view), it->lo, it->hi, &(it->v));
+  }
+  block* b = blockAt(it->c, it->blk, &view);
+  if (idx) *idx = b->offset + __builtin_ctzll(it->m);
+  if (val) *val = b->vals[it->v];
+  it->v++;
+  it->m &= it->m - 1;
+  return true;
+}
+
+bool csa_next(csa* c, int idx, int* out_idx, int* out_val) {
+  if (!c) return false;
+  if (idx < 0) idx = 0;
+  block view;
+  // Blocks are never empty, so the answer is in idx's block or the one after it
+  for (int blk = getBlockIndex(c, idx); blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    mask_t m = b->msk;
+    if (b->offset == blockOffset(idx)) m &= ~((1ull << (idx % MSKLEN)) - 1);
+    if (m) return cellAt(b, __builtin_ctzll(m), out_idx, out_val);
+  }
+  return false;
+}
+
+bool csa_prev(csa* c, int idx, int* out_idx, int* out_val) {
+  if (!c || idx < 0) return false;
+  block view;
+  int blk = getBlockIndex(c, idx);
+  if (blk < c->n && offsetAt(c, blk) == blockOffset(idx)) {
+    block* b = blockAt(c, blk, &view);
+    mask_t m = b->msk & ((idx % MSKLEN == MSKLEN - 1) ? ~0ull : (1ull << (idx % MSKLEN + 1)) - 1);
+    if (m) return cellAt(b, MSKLEN - 1 - __builtin_clzll(m), out_idx, out_val);
+  }
+  if (blk == 0) return false;
+  block* b = blockAt(c, blk - 1, &view);
+  return cellAt(b, MSKLEN - 1 - __builtin_clzll(b->msk), out_idx, out_val);
+}
+
+bool cellAt(block* b, int bit, int* idx, int* val) {
+  if (idx) *idx = b->offset + bit;
+  if (val) *val = b->vals[getValIndex(b, bit)];
+  return true;
+}
+
+int csa_range_count(csa* c, int lo, int hi) {
+  int count = 0, first;
+  block view;
+  if (!c || lo >= hi) return 0;
+  for (int blk = getBlockIndex(c, (lo < 0) ? 0 : lo); blk < c->n && offsetAt(c, blk) < (unsigned int)hi; blk++) count += __builtin_popcountl(rangeBits(blockAt(c, blk, &view), lo, hi, &first));
+  return count;
+}
+
+long long csa_range_sum(csa* c, int lo, int hi) {
+  long long sum = 0;
+  int first;
+  if (!c || lo >= hi) return 0;
+  const csaKernels* k = simdKernels();
+  block view;
+  for (int blk = getBlockIndex(c, (lo < 0) ? 0 : lo); blk < c->n && offsetAt(c, blk) < (unsigned int)hi; blk++) {
+    block* b = blockAt(c, blk, &view);
+    int count = __builtin_popcountl(rangeBits(b, lo, hi, &first));
+    if (count) sum += k->sum(b->vals + first, count);
+  }
+  return sum;
+}
+
+bool csa_range_min(csa* c, int lo, int hi, int* min) { return rangeExtreme(c, lo, hi, min, false); }
+
+bool csa_range_max(csa* c, int lo, int hi, int* max) { return rangeExtreme(c, lo, hi, max, true); }
+
+bool rangeExtreme(csa* c, int lo, int hi, int* out, bool biggest) {
+  bool found = false;
+  int best = 0, first;
+  if (!c || !out || lo >= hi) return false;
+  const csaKernels* k = simdKernels();
+  block view;
+  for (int blk = getBlockIndex(c, (lo < 0) ? 0 : lo); blk < c->n && offsetAt(c, blk) < (unsigned int)hi; blk++) {
+    block* b = blockAt(c, blk, &view);
+    int count = __builtin_popcountl(rangeBits(b, lo, hi, &first));
+    if (!count) continue;
+    int m = biggest ? k->max(b->vals + first, count) : k->min(b->vals + first, count);
+    if (!found || (biggest ? m > best : m < best)) best = m;
+    found = true;
+  }
+  if (found) *out = best;
+  return found;
+}
+
+long long csa_sum(csa* c) {
+  long long sum = 0;
+  const csaKernels* k = simdKernels();
+  block view;
+  for (int blk = 0; c && blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    sum += k->sum(b->vals, __builtin_popcountl(b->msk));
+  }
+  return sum;
+}
+
+bool csa_min(csa* c, int* min) { return wholeExtreme(c, min, false); }
+
+bool csa_max(csa* c, int* max) { return wholeExtreme(c, max, true); }
+
+bool wholeExtreme(csa* c, int* out, bool biggest) {
+  if (!c || !out || c->n == 0) return false;
+  const csaKernels* k = simdKernels();
+  block view;
+  int best = blockAt(c, 0, &view)->vals[0];
+  for (int blk = 0; blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    int count = __builtin_popcountl(b->msk);
+    int m = biggest ? k->max(b->vals, count) : k->min(b->vals, count);
+    if (biggest ? m > best : m < best) best = m;
+  }
+  *out = best;
+  return true;
+}
+
+void csa_scale(csa* c, int k) {
+  const csaKernels* kern = simdKernels();
+  if (c && !c->frozen && ownAll(c)) for (int blk = 0; blk < c->n; blk++) kern->scale(c->b[blk].vals, __builtin_popcountl(c->b[blk].msk), k);
+}
+
+void csa_add_scalar(csa* c, int k) {
+  const csaKernels* kern = simdKernels();
+  if (c && !c->frozen && ownAll(c)) for (int blk = 0; blk < c->n; blk++) kern->add(c->b[blk].vals, __builtin_popcountl(c->b[blk].msk), k);
+}
+
+long long csa_dot(csa* a, csa* b) {
+  long long dot = 0;
+  if (!a || !b) return 0;
+  const csaKernels* k = simdKernels();
+  block va, vb;
+  // Only blocks at the same offset in both can share indices
+  for (int i = 0, j = 0; i < a->n && j < b->n; ) {
+    if (offsetAt(a, i) < offsetAt(b, j)) i++;
+    else if (offsetAt(a, i) > offsetAt(b, j)) j++;
+    else dot += dotBlocks(k, blockAt(a, i++, &va), blockAt(b, j++, &vb));
+  }
+  return dot;
+}
+
+// Identical masks line the two vals arrays up exactly, otherwise walk the shared bits
+long long dotBlocks(const csaKernels* k, block* a, block* b) {
+  if (a->msk == b->msk) return k->dot(a->vals, b->vals, __builtin_popcountl(a->msk));
+  long long dot = 0;
+  for (mask_t m = a->msk & b->msk; m; m &= m - 1) {
+    int bit = __builtin_ctzll(m);
+    dot += (long long)a->vals[getValIndex(a, bit)] * b->vals[getValIndex(b, bit)];
+  }
+  return dot;
+}
+
+csa* csa_add(csa* a, csa* b) { return combine(a, b, opAdd); }
+
+csa* csa_mul(csa* a, csa* b) { return combine(a, b, opMul); }
+
+csa* csa_union(csa* a, csa* b) { return combine(a, b, opUnion); }
+
+csa* csa_intersect(csa* a, csa* b) { return combine(a, b, opIntersect); }
+
+// Merges the two directories in offset order, writing each result block once
+csa* combine(csa* a, csa* b, csaOp op) {
+  if (!a || !b) return NULL;
+  csa* c = csa_init_policy(a->policy);
+  if (!c || (a->n + b->n > 0 && !resizeBlocks(c, a->n + b->n))) {
+    csa_free(&c);
+    return NULL;
+  }
+  bool both = (op == opMul || op == opIntersect);
+  block va, vb;
+  for (int i = 0, j = 0; i < a->n || j < b->n; ) {
+    block* x = (i < a->n && (j == b->n || offsetAt(a, i) <= offsetAt(b, j))) ? blockAt(a, i, &va) : NULL;
+    block* y = (j < b->n && (i == a->n || offsetAt(b, j) <= offsetAt(a, i))) ? blockAt(b, j, &vb) : NULL;
+    i += (x != NULL);
+    j += (y != NULL);
+    if (both && !(x && y)) continue;
+    if (!combineBlocks(c, x, y, op)) {
+      csa_free(&c);
+      return NULL;
+    }
+  }
+  if (c->n == 0) {
+    csaRelease(c, c->b);
+    c->b = NULL;
+    c->cap = 0;
+  }
+  return c;
+}
+
+// Appends the block made from x and/or y (either may be NULL) to c, unless it would be empty
+bool combineBlocks(csa* c, block* x, block* y, csaOp op) {
+  mask_t xm = x ? x->msk : 0, ym = y ? y->msk : 0;
+  mask_t m = (op == opMul || op == opIntersect) ? (xm & ym) : (xm | ym);
+  if (!m) return true;
+  unsigned int count = __builtin_popcountl(m);
+  unsigned int cap = valCapacity(c->policy, 0, count);
+  int* vals = (int*)csaAlloc(c, cap * sizeof(int));
+  if (!vals) return false;
+  if (xm == m && ym == m) {
+    // Same cells in both - the two vals arrays line up
+    for (unsigned int v = 0; v < count; v++) vals[v] = combineVals(op, x->vals[v], y->vals[v]);
+  }
+  else {
+    int v = 0;
+    for (mask_t r = m; r; r &= r - 1) {
+      int bit = __builtin_ctzll(r);
+      bool inx = xm & (1ull << bit), iny = ym & (1ull << bit);
+      int xv = inx ? x->vals[getValIndex(x, bit)] : 0;
+      int yv = iny ? y->vals[getValIndex(y, bit)] : 0;
+      vals[v++] = (inx && iny) ? combineVals(op, xv, yv) : (inx ? xv : yv);
+    }
+  }
+  c->b[(c->n)++] = (block){.vals = vals, .msk = m, .offset = x ? x->offset : y->offset, .cap = cap};
+  return true;
+}
+
+// Result for a cell set in both arrays - arithmetic wraps rather than overflowing
+int combineVals(csaOp op, int x, int y) {
+  switch (op) {
+    case opAdd: return (int)((unsigned int)x + (unsigned int)y);
+    case opMul: return (int)((unsigned int)x * (unsigned int)y);
+    default: return x;
+  }
+}
+
+bool csa_stats(csa* c, struct csa_stats* out) {
+  if (!c || !out) return false;
+  block view;
+  *out = (struct csa_stats){.blocks = c->n, .segments = c->ndense};
+  out->bytes = sizeof(csa) + (size_t)c->cap * sizeof(block) + (size_t)c->ndense * sizeof(segment);
+  for (int s = 0; s < c->ndense; s++) {
+    size_t bytes = (size_t)c->dense[s].cap * MSKLEN * sizeof(int);
+    out->bytes += bytes;
+    out->shared += segmentShared(c, s) ? bytes : 0;
+  }
+  for (int blk = 0, s = 0; blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    int count = __builtin_popcountll(b->msk);
+    out->values += count;
+    out->fill[(count - 1) * 8 / MSKLEN]++;
+    // Values in a segment were counted with it
+    while (s < c->ndense && b->offset >= c->dense[s].offset + (unsigned int)c->dense[s].blocks * MSKLEN) s++;
+    if (!c->map && !(s < c->ndense && b->offset >= c->dense[s].offset)) {
+      out->bytes += b->cap * sizeof(int);
+      out->shared += isShared(b->refs) ? b->cap * sizeof(int) : 0;
+    }
+  }
+  if (c->map) out->bytes += c->map->len;
+#ifdef CSA_STATS
+  out->gets = c->gets;
+  out->sets = c->sets;
+  out->deletes = c->deletes;
+  out->probes = c->probes;
+  out->reallocs = c->reallocs;
+#endif
+  return true;
+}
+
 void csa_tostring(csa* c, char* s) {
   if (!c) return;
   int startIndex = 0;
   startIndex += snprintf(s + startIndex, BIGSTR - startIndex, "%d block%s", c->n, (c->n == 1) ? " " : ((c->n == 0) ? "s" : "s ")); 
-  for (int i = 0; i < c->n; i++) printBlock(&(c->b[i]), s);
+  block view;
+  for (int i = 0; i < c->n; i++) printBlock(blockAt(c, i, &view), s);
 }
 
 void printBlock(block* b, char* s) {
@@ -55,7 +862,20 @@ void printBlock(block* b, char* s) {
 }
 
 void csa_free(csa** l) {
-  if (*l) for (int i = 0; i < (*l)->n; i++) free((*l)->b[i].vals);
+  // Nothing in an arena is freed one at a time
+  if (*l && (*l)->arena) {
+    *l = NULL;
+    return;
+  }
+  if (*l && (*l)->map) unmapFile((*l)->map);
+  // Blocks in a segment share its vals, freed below
+  else if (*l) for (int i = 0, s = 0; i < (*l)->n; i++) {
+    segment* g = (*l)->dense;
+    while (s < (*l)->ndense && (*l)->b[i].offset >= g[s].offset + (unsigned int)g[s].blocks * MSKLEN) s++;
+    if (!(s < (*l)->ndense && (*l)->b[i].offset >= g[s].offset)) dropVals(*l, (*l)->b[i].vals, (*l)->b[i].refs);
+  }
+  for (int s = 0; *l && s < (*l)->ndense; s++) dropVals(*l, segmentArray(&((*l)->dense[s])), (*l)->dense[s].refs);
+  if (*l) free((*l)->dense);
   if (*l) free((*l)->b);
   if (*l) free(*l);
   *l = NULL;
@@ -66,29 +886,102 @@ void test(void) {
 }
 
 #ifdef EXT
-void csa_foreach(void (*func)(int* p, int* ac), csa* c, int* ac) { for (int blk = 0; blk < c->n; blk++) for (int v = 0; v < __builtin_popcountl(c->b[blk].msk); v++) func(&(c->b[blk].vals[v]), ac); }
+void csa_foreach(void (*func)(int* p, int* ac), csa* c, int* ac) {
+  block view;
+  // A mapped file or snapshot is read-only, so func gets a copy it may scribble on
+  bool copies = c->frozen || !ownAll(c);
+  for (int blk = 0; blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    for (int v = 0; v < __builtin_popcountl(b->msk); v++) {
+      int copy = b->vals[v];
+      func(copies ? &copy : &(b->vals[v]), ac);
+    }
+  }
+}
 
 bool csa_delete(csa* c, int indx) {
-  int blockIndex = 0;
-  while (blockIndex < c->n && c->b[blockIndex].offset <= (unsigned int)(indx/(int)MSKLEN) * MSKLEN) blockIndex++;
-  if ((blockIndex == 0 || c->b[--blockIndex].offset > (unsigned int)(indx/(int)MSKLEN) * MSKLEN) || !(c->b[blockIndex].msk & (1ull << (indx % MSKLEN)))) return false;
-
-  int valIndex = getValIndex(&(c->b[blockIndex]), indx % MSKLEN);
-  int* temp = (int*)malloc(sizeof(int) * (__builtin_popcountl(c->b[blockIndex].msk) - 1));
-  if (!temp) return false;
-
-  memcpy(temp, c->b[blockIndex].vals, valIndex * sizeof(int));
-  memcpy(temp + valIndex, c->b[blockIndex].vals + valIndex + 1, (__builtin_popcountl(c->b[blockIndex].msk) - valIndex - 1) * sizeof(int));
+  if (!c || indx < 0 || c->frozen) return false;
+  CSA_STAT(c, deletes, 1);
+  int blockIndex = lookupBlock(c, indx);
+  if (blockIndex == c->n || c->b[blockIndex].offset != blockOffset(indx) || !(c->b[blockIndex].msk & (1ull << (indx % MSKLEN)))) return false;
+  // A gap in a segment takes just that block out of it
+  int s = c->ndense ? segmentAt(c, indx) : -1;
+  if (s >= 0 && !splitSegment(c, s, blockIndex)) return false;
 
-  free(c->b[blockIndex].vals);
-  c->b[blockIndex].vals = temp;
+  block* b = &(c->b[blockIndex]);
+  if (!ownBlock(c, b)) return false;
+  int valIndex = getValIndex(b, indx % MSKLEN);
+  memmove(b->vals + valIndex, b->vals + valIndex + 1, (__builtin_popcountl(b->msk) - valIndex - 1) * sizeof(int));
 
-  if (c->b[blockIndex].msk &= ~(1ull << (indx % MSKLEN))) return true; 
-  free(c->b[blockIndex].vals);
-  for (int i = blockIndex; i < c->n - 1; i++) c->b[i] = c->b[i + 1];
+  if (b->msk &= ~(1ull << (indx % MSKLEN))) {
+    shrinkVals(c, b);
+    return true;
+  }
+  csaRelease(c, b->vals);
+  memmove(c->b + blockIndex, c->b + blockIndex + 1, (c->n - blockIndex - 1) * sizeof(block));
   if (--(c->n) == 0) {
-    free(c->b);
+    csaRelease(c, c->b);
+    c->cap = 0;
     return !(c->b = NULL);
-  } else return (c->b = (block*)realloc(c->b, c->n * sizeof(block)));
+  }
+  // Shrinking only once three quarters are unused stops a set/delete pair thrashing realloc()
+  if (c->n <= c->cap / 4) resizeBlocks(c, c->cap / 2);
+  return true;
+}
+
+bool csa_delete_begin(csa* c, int lo, int hi) {
+  if (!c || c->frozen || lo < 0) return false;
+  for (int s = 0; s < c->ndense; ) {
+    segment* g = &(c->dense[s]);
+    bool overlaps = g->offset < (unsigned int)hi && g->offset + (unsigned int)g->blocks * MSKLEN > (unsigned int)lo;
+    if (!overlaps) s++;
+    else if (!demote(c, s)) return false;
+  }
+  for (int blk = getBlockIndex(c, lo); blk < c->n && c->b[blk].offset < (unsigned int)hi; blk++) {
+    if (!ownBlock(c, &(c->b[blk]))) return false;
+  }
+  c->dlo = lo;
+  c->dhi = hi;
+  return true;
+}
+
+long csa_delete_bits(csa* c, int lo, const mask_t* bits, int n) {
+  if (!c || !bits || lo < 0 || lo % MSKLEN || n <= 0) return 0;
+  // getBlockIndex() bumps no counters, so this is safe from several threads
+  int blk = getBlockIndex(c, lo);
+  long cleared = 0;
+  for (; blk < c->n && c->b[blk].offset < (unsigned int)lo + (unsigned int)n * MSKLEN; blk++) {
+    block* b = &(c->b[blk]);
+    mask_t gone = b->msk & bits[(b->offset - (unsigned int)lo) / MSKLEN];
+    if (!gone) continue;
+    // Close up the values in one pass
+    int w = 0, v = 0;
+    for (mask_t m = b->msk; m; m &= m - 1, v++) if (!(gone & m & -m)) b->vals[w++] = b->vals[v];
+    b->msk &= ~gone;
+    cleared += __builtin_popcountll(gone);
+  }
+  return cleared;
+}
+
+void csa_delete_end(csa* c) {
+  if (!c || c->frozen) return;
+  int w = 0;
+  for (int blk = 0; blk < c->n; blk++) {
+    // Blocks outside the range were never copied, so may still be a snapshot's too
+    bool inRange = c->b[blk].offset + MSKLEN > (unsigned int)c->dlo && c->b[blk].offset < (unsigned int)c->dhi;
+    if (inRange && !c->b[blk].msk) {
+      dropVals(c, c->b[blk].vals, c->b[blk].refs);
+      continue;
+    }
+    if (inRange) shrinkVals(c, &(c->b[blk]));
+    c->b[w++] = c->b[blk];
+  }
+  c->n = w;
+  if (c->n == 0) {
+    csaRelease(c, c->b);
+    c->b = NULL;
+    c->cap = 0;
+  }
+  else if (c->n <= c->cap / 4) resizeBlocks(c, c->n * 2);
 }
 #endif
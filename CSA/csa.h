@@ -15,37 +15,266 @@ struct block {
    int* vals;
    mask_t msk;
    unsigned int offset;
+   // Number of slots allocated in vals (at least the popcount of msk)
+   unsigned int cap;
+   // How many CSAs hold vals, once csa_snapshot() has shared it - NULL
+   // while only this one does
+   int* refs;
 };
 typedef struct block block;
 
+// A run of back-to-back full blocks whose values share one plain array, so any
+// index in it is read straight from vals[idx - offset]. The blocks stay in the
+// directory as usual, each pointing at its own MSKLEN-long stretch of vals.
+struct segment {
+   int* vals;
+   // Where vals' array starts, if a split left vals partway into it - NULL
+   // otherwise
+   int* base;
+   unsigned int offset;
+   // Number of blocks covered, and room allocated for
+   int blocks;
+   int cap;
+   // As for a block
+   int* refs;
+};
+typedef struct segment segment;
+
+// How each block's value storage trades memory for speed
+typedef enum {
+   csa_compact,  // exactly one slot per value, resized on every insert & delete
+   csa_balanced, // capacity doubles when full, halves when a quarter full
+   csa_fast      // every block reserves all MSKLEN slots up front
+} csa_policy;
+
+// Memory handed over by the caller, for CSAs that are made, filled & thrown away
+// together. Each allocation is a pointer bump; nothing is given back until the
+// whole arena is reset.
+struct csa_arena {
+   unsigned char* base;
+   size_t size;
+   // Bytes handed out so far, and where the latest allocation starts
+   size_t used;
+   size_t last;
+};
+typedef struct csa_arena csa_arena;
+
 struct csa {
    // realloc-style array
    block* b;
    int n;
+   // Number of blocks allocated in b
+   int cap;
+   csa_policy policy;
+   // Set when opened with csa_open_mmap() - the blocks then live in the file, not in b
+   struct csa_map* map;
+   // realloc-style array, in offset order
+   segment* dense;
+   int ndense;
+   // Set when made with csa_init_arena() - everything, the csa included, lives there
+   csa_arena* arena;
+   // Set for snapshots & mapped files, which can't be changed
+   bool frozen;
+   // The range readied by csa_delete_begin(), for csa_delete_end() to tidy up
+   int dlo;
+   int dhi;
+#ifdef CSA_STATS
+   // Running totals for csa_stats()
+   long long gets;
+   long long sets;
+   long long deletes;
+   long long probes;
+   long long reallocs;
+#endif
 };
 typedef struct csa csa;
 
+// Same as csa_init_policy(csa_balanced)
 csa* csa_init(void);
 
+// Creates an empty CSA whose blocks grow according to p
+csa* csa_init_policy(csa_policy p);
+
+// Lets CSAs use the size bytes at buf - which must outlive them
+void csa_arena_init(csa_arena* a, void* buf, size_t size);
+
+// Frees every CSA made in a at once, in O(1). None of them may be used again.
+void csa_arena_reset(csa_arena* a);
+
+// Creates an empty, csa_balanced CSA whose blocks & values are all carved out
+// of a. Resized arrays are copied, so their old room is only reclaimed by
+// csa_arena_reset(). Running out of room acts like running out of memory, and
+// csa_free() just drops the pointer. Returns NULL if a is NULL or full.
+csa* csa_init_arena(csa_arena* a);
+
 // Adds a new index/value, or overwrites
 // the value if the index already exists.
-// Returns true, unless c is NULL.
+// Returns true, unless c is NULL (or memory runs out).
 bool csa_set(csa* c, int idx, int val);
 
 // If cell has already been written, sets *n = csa[idx] & returns true.
 // If any of the pointers is NULL, or if the cell is unset, returns false.
 bool csa_get(csa* c, int idx, int* n);
 
+// Sets csa[idx[i]] = val[i] for every i < n, later entries winning on duplicates.
+// When idx is in ascending order all blocks are built in one pass, otherwise it
+// falls back to one csa_set() per entry. Returns false if c is NULL, an index
+// is negative or memory runs out (some entries may then still have been set).
+bool csa_set_many(csa* c, const int* idx, const int* val, int n);
+
+// Sets csa[lo+i] = vals[i] for every i < n, in one pass.
+bool csa_set_range(csa* c, int lo, const int* vals, int n);
+
+// Copies up to max (index, value) pairs with index >= from into idx[] & val[],
+// in ascending index order, and returns how many were copied.
+// To read everything, call again with from = idx[last] + 1 until it returns 0.
+int csa_export(csa* c, int from, int* idx, int* val, int max);
+
+// Finds the first set cell with index >= idx (csa_next) or the last one with
+// index <= idx (csa_prev), and sets *out_idx & *out_val (either may be NULL).
+// Returns false if there isn't one.
+bool csa_next(csa* c, int idx, int* out_idx, int* out_val);
+bool csa_prev(csa* c, int idx, int* out_idx, int* out_val);
+
+// Walks the set cells with lo <= index < hi in ascending index order:
+//    csa_iter it;
+//    csa_iter_init(&it, c, lo, hi);
+//    while(csa_iter_next(&it, &idx, &val)){ ... }
+// The CSA mustn't be changed while an iterator is in use.
+struct csa_iter {
+   csa* c;
+   int blk;
+   // Bits of block blk still to visit, and where the lowest one's value is
+   mask_t m;
+   int v;
+   int lo;
+   int hi;
+};
+typedef struct csa_iter csa_iter;
+
+void csa_iter_init(csa_iter* it, csa* c, int lo, int hi);
+
+// Sets *idx & *val (either may be NULL) to the next cell and returns true,
+// or returns false once the range is exhausted.
+bool csa_iter_next(csa_iter* it, int* idx, int* val);
+
+// Aggregates over the set cells with lo <= index < hi.
+// min & max return false, leaving *out alone, if there are no such cells.
+int csa_range_count(csa* c, int lo, int hi);
+long long csa_range_sum(csa* c, int lo, int hi);
+bool csa_range_min(csa* c, int lo, int hi, int* min);
+bool csa_range_max(csa* c, int lo, int hi, int* max);
+
+// Whole-array reductions & updates, which work straight on each block's vals
+// using AVX2 or SSE4.1 where the CPU has them. csa_min/csa_max return false,
+// leaving *out alone, on an empty CSA. csa_scale multiplies, and csa_add_scalar
+// adds k to, every value (wrapping on overflow) - values shared with a
+// snapshot are copied first, and if memory runs out nothing changes.
+long long csa_sum(csa* c);
+bool csa_min(csa* c, int* min);
+bool csa_max(csa* c, int* max);
+void csa_scale(csa* c, int k);
+void csa_add_scalar(csa* c, int k);
+
+// Sum of a[i]*b[i] over the indices set in both
+long long csa_dot(csa* a, csa* b);
+
+// Elementwise operations, each returning a new CSA (or NULL if either input is
+// NULL or memory runs out) made in one pass over both block directories.
+// Unset cells count as 0 for add, so the result is set wherever either is;
+// mul is set only where both are. union takes every cell of both, preferring
+// a's value; intersect takes a's values where b is also set.
+csa* csa_add(csa* a, csa* b);
+csa* csa_mul(csa* a, csa* b);
+csa* csa_union(csa* a, csa* b);
+csa* csa_intersect(csa* a, csa* b);
+
+// Forces the kernels used above to "scalar", "sse4.1" or "avx2" - returns false,
+// changing nothing, if this CPU can't run them. NULL goes back to the best one.
+// Meant for start-up & tests : don't call it while other threads are querying,
+// as a query that spans the switch may use both sets of kernels.
+bool csa_simd_select(const char* name);
+// Name of the kernels in use
+const char* csa_simd_name(void);
+
+// Writes c to path as a header, the block directory - (offset, mask) pairs in
+// offset order - and then every value, packed. Returns false on any I/O error.
+bool csa_save(csa* c, const char* path);
+
+// Maps a file written by csa_save() read-only, without making a block at a time :
+// the directory is read once to check it, the values not at all. csa_get,
+// csa_next/csa_prev, csa_iter, csa_export, the range & whole-array queries and
+// the elementwise operations all read straight from the mapping; anything that
+// would change it returns false or does nothing (csa_foreach's func sees copies
+// of the values). csa_free() unmaps it. Returns NULL if the file can't be
+// mapped, isn't a CSA file, or its directory is out of order or doesn't add up
+// to the values that follow it.
+csa* csa_open_mmap(const char* path);
+
+// A read-only copy of what c holds now, which later changes to c don't show
+// up in. Only the block directory is copied : the values stay where they are,
+// shared, until c next writes to a block - that block alone then gets its own
+// copy, even if it is part of a dense segment. Reading a snapshot while c is
+// written to from another thread is safe, as are csa_free() & csa_snapshot()
+// of the snapshot itself. It can't be changed, as for a mapped
+// file, and lives in c's arena if c has one. Returns NULL if c is NULL or
+// mapped, or if memory runs out.
+csa* csa_snapshot(csa* c);
+
+// What csa_stats() reports. The running totals only count when the library is
+// built with -DCSA_STATS (they stay 0 otherwise, and cost nothing).
+struct csa_stats {
+   int blocks;
+   int values;
+   int segments;
+   // Heap in use, headers included, and how much of that is values shared
+   // with a snapshot (or with what this is a snapshot of)
+   size_t bytes;
+   size_t shared;
+   // Blocks by how full they are : fill[i] counts those with more than
+   // i*MSKLEN/8, and at most (i+1)*MSKLEN/8, cells set
+   int fill[8];
+   long long gets;
+   long long sets;
+   long long deletes;
+   // Blocks looked at while searching the directory in csa_get/set/delete
+   long long probes;
+   // Directory & value arrays resized
+   long long reallocs;
+};
+
+// Fills in *out - returns false if either pointer is NULL
+bool csa_stats(csa* c, struct csa_stats* out);
+
 // Produces a stringified version of the CSA (see driver.c)
 void csa_tostring(csa* c, char* s);
 
 // Deletes an array entry - returns
-// false if it was never set anyway,
-// true if it was.
+// false if it was never set anyway (or
+// memory ran out), true if it was.
 bool csa_delete(csa* c, int idx);
 
+// Deletes in batches, a block at a time, for callers (such as a sieve) clearing
+// many cells at once - possibly from several threads :
+//    csa_delete_begin(c, lo, hi);
+//    csa_delete_bits(c, lo, bits, n);   ... any number of times, within [lo, hi)
+//    csa_delete_end(c);
+// csa_delete_begin() readies every block holding an index in [lo, hi) - splitting
+// dense segments & copying values shared with snapshots - and returns false if
+// c is NULL or frozen, or memory runs out. csa_delete_bits() then clears every
+// index lo + MSKLEN*k + j with bit j of bits[k] set, for k < n (lo must be a
+// multiple of MSKLEN), and returns how many were set. It never allocates or
+// moves blocks, so calls covering different blocks may run at the same time.
+// Emptied blocks stay in the directory until csa_delete_end(), which drops
+// them & gives back spare room in [lo, hi) only; in between only
+// csa_delete_bits() may be used.
+bool csa_delete_begin(csa* c, int lo, int hi);
+long csa_delete_bits(csa* c, int lo, const mask_t* bits, int n);
+void csa_delete_end(csa* c);
+
 // Call func() for every valid value of array.
-// func() pass a pointer to the stored integer value.
+// func() pass a pointer to the stored integer value (or to a copy, if c
+// can't be changed or memory ran out copying values shared with a snapshot).
 void csa_foreach(void (*func)(int* p, int* acc), csa* c, int* ac);
 
 // Usage : csa_free(&c)
@@ -0,0 +1,96 @@
+// Saving a CSA to disk, and mapping it back in read-only (see mydefs.h for the layout)
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "csa.h"
+#include "mydefs.h"
+
+static bool saveTo(csa* c, FILE* f) {
+  block view;
+  csaFileHeader h = {.nblocks = (uint64_t)c->n};
+  memcpy(h.magic, CSA_FILE_MAGIC, sizeof(h.magic));
+  for (int blk = 0; blk < c->n; blk++) h.nvals += __builtin_popcountll(blockAt(c, blk, &view)->msk);
+  if (h.nvals > UINT32_MAX || fwrite(&h, sizeof(h), 1, f) != 1) return false;
+  uint32_t start = 0;
+  for (int blk = 0; blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    csaFileBlock e = {.msk = b->msk, .offset = b->offset, .start = start};
+    if (fwrite(&e, sizeof(e), 1, f) != 1) return false;
+    start += __builtin_popcountll(b->msk);
+  }
+  for (int blk = 0; blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    size_t count = __builtin_popcountll(b->msk);
+    if (fwrite(b->vals, sizeof(int), count, f) != count) return false;
+  }
+  return true;
+}
+
+bool csa_save(csa* c, const char* path) {
+  if (!c || !path) return false;
+  FILE* f = fopen(path, "wb");
+  if (!f) return false;
+  bool ok = saveTo(c, f);
+  // Buffered writes can still fail on close
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) remove(path);
+  return ok;
+}
+
+static bool validHeader(const csaFileHeader* h, size_t len) {
+  if (memcmp(h->magic, CSA_FILE_MAGIC, sizeof(h->magic)) != 0 || h->nblocks > INT_MAX || h->nvals > UINT32_MAX) return false;
+  return len == sizeof(csaFileHeader) + h->nblocks * sizeof(csaFileBlock) + h->nvals * sizeof(int);
+}
+
+// Queries trust the directory, so a bad one would read outside the mapping. One pass
+// over it - the values themselves are never touched.
+static bool validDirectory(const csaFileBlock* dir, uint64_t nblocks, uint64_t nvals) {
+  uint64_t start = 0;
+  for (uint64_t blk = 0; blk < nblocks; blk++) {
+    const csaFileBlock* e = &(dir[blk]);
+    if (e->offset % MSKLEN || e->offset > (unsigned int)INT_MAX - (MSKLEN - 1)) return false;
+    // Every query takes a block to hold at least one value
+    if (e->msk == 0) return false;
+    if (blk > 0 && e->offset <= dir[blk - 1].offset) return false;
+    if (e->start != start) return false;
+    start += __builtin_popcountll(e->msk);
+    if (start > nvals) return false;
+  }
+  return start == nvals;
+}
+
+csa* csa_open_mmap(const char* path) {
+  if (!path) return NULL;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  void* base = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(csaFileHeader)) base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps the file open by itself
+  close(fd);
+  if (base == MAP_FAILED) return NULL;
+
+  const csaFileHeader* h = (const csaFileHeader*)base;
+  struct csa_map* m = NULL;
+  csa* c = NULL;
+  if (!validHeader(h, st.st_size) || !validDirectory((const csaFileBlock*)(h + 1), h->nblocks, h->nvals) || !(m = (struct csa_map*)malloc(sizeof(struct csa_map))) || !(c = csa_init())) {
+    free(m);
+    munmap(base, st.st_size);
+    return NULL;
+  }
+  m->base = base;
+  m->len = st.st_size;
+  m->dir = (const csaFileBlock*)(h + 1);
+  m->vals = (const int*)(m->dir + h->nblocks);
+  c->map = m;
+  c->frozen = true;
+  c->n = (int)h->nblocks;
+  return c;
+}
+
+void unmapFile(struct csa_map* m) {
+  munmap(m->base, m->len);
+  free(m);
+}
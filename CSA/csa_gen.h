@@ -0,0 +1,179 @@
+// Generates a CSA specialised to one element type. Define CSA_NAME (used as
+// the type name & function prefix) and CSA_TYPE (the element type), then
+// include this file. It can be included again for each further type:
+//
+//    #define CSA_NAME csa_pt
+//    #define CSA_TYPE struct point
+//    #include "csa_gen.h"
+//
+// gives the type csa_pt, with csa_pt_init(), csa_pt_set(), csa_pt_get(),
+// csa_pt_delete(), csa_pt_next(), csa_pt_count() & csa_pt_free(), which behave
+// like their csa_ counterparts. Blocks use the same bitmask & popcount layout
+// as csa, growing like csa_balanced. See csa_types.h for ready-made ones.
+#include "csa.h"
+
+#if !defined(CSA_NAME) || !defined(CSA_TYPE)
+#error "Define CSA_NAME and CSA_TYPE before including csa_gen.h"
+#endif
+
+#ifndef CSA_CAT
+#define CSA_CAT2(a, b) a##_##b
+#define CSA_CAT(a, b) CSA_CAT2(a, b)
+#endif
+#define CSA_FN(f) CSA_CAT(CSA_NAME, f)
+#define CSA_BLOCK CSA_FN(block)
+
+struct CSA_BLOCK {
+   // realloc-style array
+   CSA_TYPE* vals;
+   mask_t msk;
+   unsigned int offset;
+   unsigned int cap;
+};
+typedef struct CSA_BLOCK CSA_BLOCK;
+
+struct CSA_NAME {
+   // realloc-style array, ordered by offset
+   CSA_BLOCK* b;
+   int n;
+   int cap;
+};
+typedef struct CSA_NAME CSA_NAME;
+
+static inline CSA_NAME* CSA_FN(init)(void) { return (CSA_NAME*)calloc(1, sizeof(CSA_NAME)); }
+
+// Index of the first block whose offset is not below idx's block, or c->n if there is none
+static inline int CSA_FN(findblock)(CSA_NAME* c, int idx) {
+  int lo = 0, hi = c->n;
+  while (lo < hi) {
+    int mid = lo + ((hi - lo) >> 1);
+    if (c->b[mid].offset < (unsigned int)(idx / MSKLEN) * MSKLEN) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static inline bool CSA_FN(get)(CSA_NAME* c, int idx, CSA_TYPE* val) {
+  if (!c || !val || idx < 0) return false;
+  int blk = CSA_FN(findblock)(c, idx);
+  if (blk == c->n || c->b[blk].offset != (unsigned int)(idx / MSKLEN) * MSKLEN) return false;
+  CSA_BLOCK* b = &(c->b[blk]);
+  if (!(b->msk & (1ull << (idx % MSKLEN)))) return false;
+  *val = b->vals[__builtin_popcountll(b->msk & ((1ull << (idx % MSKLEN)) - 1))];
+  return true;
+}
+
+static inline bool CSA_FN(set)(CSA_NAME* c, int idx, CSA_TYPE val) {
+  if (!c || idx < 0) return false;
+  int blk = CSA_FN(findblock)(c, idx);
+  unsigned int off = (unsigned int)(idx / MSKLEN) * MSKLEN;
+  if (blk == c->n || c->b[blk].offset != off) {
+    if (c->n == c->cap) {
+      int cap = c->cap ? c->cap * 2 : 1;
+      CSA_BLOCK* temp = (CSA_BLOCK*)realloc(c->b, cap * sizeof(CSA_BLOCK));
+      if (!temp) return false;
+      c->b = temp;
+      c->cap = cap;
+    }
+    CSA_TYPE* vals = (CSA_TYPE*)malloc(sizeof(CSA_TYPE));
+    if (!vals) return false;
+    memmove(c->b + blk + 1, c->b + blk, (c->n - blk) * sizeof(CSA_BLOCK));
+    c->b[blk] = (CSA_BLOCK){.vals = vals, .msk = 0, .offset = off, .cap = 1};
+    c->n++;
+  }
+
+  CSA_BLOCK* b = &(c->b[blk]);
+  mask_t bit = 1ull << (idx % MSKLEN);
+  unsigned int v = __builtin_popcountll(b->msk & (bit - 1));
+  if (b->msk & bit) {
+    b->vals[v] = val;
+    return true;
+  }
+  unsigned int count = __builtin_popcountll(b->msk);
+  if (count == b->cap) {
+    unsigned int cap = (b->cap * 2 > MSKLEN) ? MSKLEN : b->cap * 2;
+    CSA_TYPE* temp = (CSA_TYPE*)realloc(b->vals, cap * sizeof(CSA_TYPE));
+    if (!temp) return false;
+    b->vals = temp;
+    b->cap = cap;
+  }
+  memmove(b->vals + v + 1, b->vals + v, (count - v) * sizeof(CSA_TYPE));
+  b->vals[v] = val;
+  b->msk |= bit;
+  return true;
+}
+
+static inline bool CSA_FN(delete)(CSA_NAME* c, int idx) {
+  if (!c || idx < 0) return false;
+  int blk = CSA_FN(findblock)(c, idx);
+  mask_t bit = 1ull << (idx % MSKLEN);
+  if (blk == c->n || c->b[blk].offset != (unsigned int)(idx / MSKLEN) * MSKLEN || !(c->b[blk].msk & bit)) return false;
+
+  CSA_BLOCK* b = &(c->b[blk]);
+  unsigned int v = __builtin_popcountll(b->msk & (bit - 1));
+  unsigned int count = __builtin_popcountll(b->msk);
+  memmove(b->vals + v, b->vals + v + 1, (count - v - 1) * sizeof(CSA_TYPE));
+  if ((b->msk &= ~bit)) {
+    if (count - 1 <= b->cap / 4) {
+      CSA_TYPE* temp = (CSA_TYPE*)realloc(b->vals, (b->cap / 2) * sizeof(CSA_TYPE));
+      if (temp) {
+        b->vals = temp;
+        b->cap /= 2;
+      }
+    }
+    return true;
+  }
+
+  free(b->vals);
+  memmove(c->b + blk, c->b + blk + 1, (c->n - blk - 1) * sizeof(CSA_BLOCK));
+  if (--(c->n) == 0) {
+    free(c->b);
+    c->b = NULL;
+    c->cap = 0;
+  }
+  else if (c->n <= c->cap / 4) {
+    CSA_BLOCK* temp = (CSA_BLOCK*)realloc(c->b, (c->cap / 2) * sizeof(CSA_BLOCK));
+    if (temp) {
+      c->b = temp;
+      c->cap /= 2;
+    }
+  }
+  return true;
+}
+
+// First set cell with index >= idx - either output may be NULL
+static inline bool CSA_FN(next)(CSA_NAME* c, int idx, int* out_idx, CSA_TYPE* out_val) {
+  if (!c) return false;
+  if (idx < 0) idx = 0;
+  for (int blk = CSA_FN(findblock)(c, idx); blk < c->n; blk++) {
+    CSA_BLOCK* b = &(c->b[blk]);
+    mask_t m = b->msk;
+    if (b->offset == (unsigned int)(idx / MSKLEN) * MSKLEN) m &= ~((1ull << (idx % MSKLEN)) - 1);
+    if (m) {
+      int bit = __builtin_ctzll(m);
+      if (out_idx) *out_idx = b->offset + bit;
+      if (out_val) *out_val = b->vals[__builtin_popcountll(b->msk & ((1ull << bit) - 1))];
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline int CSA_FN(count)(CSA_NAME* c) {
+  int count = 0;
+  if (c) for (int blk = 0; blk < c->n; blk++) count += __builtin_popcountll(c->b[blk].msk);
+  return count;
+}
+
+// Usage : csa_xxx_free(&c)
+static inline void CSA_FN(free)(CSA_NAME** l) {
+  if (*l) for (int i = 0; i < (*l)->n; i++) free((*l)->b[i].vals);
+  if (*l) free((*l)->b);
+  if (*l) free(*l);
+  *l = NULL;
+}
+
+#undef CSA_BLOCK
+#undef CSA_FN
+#undef CSA_NAME
+#undef CSA_TYPE
@@ -0,0 +1,296 @@
+#define _POSIX_C_SOURCE 200809L
+#include <sched.h>
+#include "csa_mt.h"
+#include "mydefs.h"
+
+// Values live inline, so a block never moves or reallocs while it is being read
+typedef struct {
+  mask_t msk;
+  unsigned int offset;
+  // Odd while a writer is part way through changing the block
+  unsigned int seq;
+  // Unlinked from the directory - a writer that finds it must look again
+  bool dead;
+  int vals[MSKLEN];
+} mtBlock;
+
+// Never changed once published, only replaced
+struct csa_mt_dir {
+  int n;
+  mtBlock* b[];
+};
+
+static int readerStripe(void) {
+  // Each thread takes the next counter the first time it reads, so up to CSA_MT_STRIPES threads never share one
+  static unsigned int next = 0;
+  static __thread int stripe = -1;
+  if (stripe < 0) stripe = (int)(__atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % CSA_MT_STRIPES);
+  return stripe;
+}
+
+// Enters a read-side section - until readUnlock() no directory or block seen inside it is freed
+static int readLock(csa_mt* c, unsigned long* e) {
+  int stripe = readerStripe();
+  for (;;) {
+    *e = __atomic_load_n(&c->epoch, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&c->readers[stripe].count[*e & 1], 1, __ATOMIC_SEQ_CST);
+    // A writer flipped the epoch in between, so it may not have seen us - count in on the new side
+    if (__atomic_load_n(&c->epoch, __ATOMIC_SEQ_CST) == *e) return stripe;
+    __atomic_fetch_sub(&c->readers[stripe].count[*e & 1], 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+static void readUnlock(csa_mt* c, int stripe, unsigned long e) { __atomic_fetch_sub(&c->readers[stripe].count[e & 1], 1, __ATOMIC_SEQ_CST); }
+
+// Waits out every reader that could still hold the old directory. Callers hold dirlock.
+static void synchronize(csa_mt* c) {
+  unsigned long e = __atomic_fetch_add(&c->epoch, 1, __ATOMIC_SEQ_CST);
+  for (int s = 0; s < CSA_MT_STRIPES; s++) {
+    while (__atomic_load_n(&c->readers[s].count[e & 1], __ATOMIC_SEQ_CST)) sched_yield();
+  }
+}
+
+static csa_mt_dir* currentDir(csa_mt* c) { return __atomic_load_n(&c->dir, __ATOMIC_SEQ_CST); }
+
+// Position of the first block whose offset is not below idx's block
+static int findPos(csa_mt_dir* d, int idx) {
+  int lo = 0, hi = d->n;
+  while (lo < hi) {
+    int mid = lo + ((hi - lo) >> 1);
+    if (d->b[mid]->offset < blockOffset(idx)) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static mtBlock* findBlock(csa_mt_dir* d, int idx) {
+  int pos = findPos(d, idx);
+  return (pos < d->n && d->b[pos]->offset == blockOffset(idx)) ? d->b[pos] : NULL;
+}
+
+static pthread_mutex_t* stripeLock(csa_mt* c, mtBlock* b) { return &(c->stripes[(b->offset / MSKLEN) % CSA_MT_STRIPES]); }
+
+// Copies the block's mask & values as of one moment, retrying if a writer was part way through
+static mask_t readBlock(mtBlock* b, int* vals) {
+  for (;;) {
+    unsigned int seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;
+    mask_t m = __atomic_load_n(&b->msk, __ATOMIC_ACQUIRE);
+    for (int v = 0; vals && v < __builtin_popcountll(m); v++) vals[v] = __atomic_load_n(&b->vals[v], __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&b->seq, __ATOMIC_RELAXED) == seq) return m;
+  }
+}
+
+static bool readCell(mtBlock* b, int bit, int* val) {
+  for (;;) {
+    unsigned int seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;
+    mask_t m = __atomic_load_n(&b->msk, __ATOMIC_ACQUIRE);
+    bool set = m & (1ull << bit);
+    int v = set ? __atomic_load_n(&b->vals[__builtin_popcountll(m & ((1ull << bit) - 1))], __ATOMIC_ACQUIRE) : 0;
+    if (__atomic_load_n(&b->seq, __ATOMIC_RELAXED) == seq) {
+      if (set) *val = v;
+      return set;
+    }
+  }
+}
+
+// Changes to a block happen between these two, with its stripe lock held. Every store in between is a
+// release, so a reader that loads any of them (with acquire) also sees the odd seq before it - no fences
+static void beginWrite(mtBlock* b) { __atomic_store_n(&b->seq, __atomic_load_n(&b->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED); }
+
+static void endWrite(mtBlock* b) { __atomic_store_n(&b->seq, __atomic_load_n(&b->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE); }
+
+static void putCell(mtBlock* b, int bit, int val) {
+  mask_t m = __atomic_load_n(&b->msk, __ATOMIC_RELAXED);
+  int v = __builtin_popcountll(m & ((1ull << bit) - 1));
+  beginWrite(b);
+  if (!(m & (1ull << bit))) {
+    for (int i = __builtin_popcountll(m); i > v; i--) __atomic_store_n(&b->vals[i], __atomic_load_n(&b->vals[i - 1], __ATOMIC_RELAXED), __ATOMIC_RELEASE);
+    __atomic_store_n(&b->msk, m | (1ull << bit), __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&b->vals[v], val, __ATOMIC_RELEASE);
+  endWrite(b);
+}
+
+static bool removeCell(mtBlock* b, int bit) {
+  mask_t m = __atomic_load_n(&b->msk, __ATOMIC_RELAXED);
+  if (!(m & (1ull << bit))) return false;
+  int count = __builtin_popcountll(m);
+  beginWrite(b);
+  for (int i = __builtin_popcountll(m & ((1ull << bit) - 1)); i < count - 1; i++) __atomic_store_n(&b->vals[i], __atomic_load_n(&b->vals[i + 1], __ATOMIC_RELAXED), __ATOMIC_RELEASE);
+  __atomic_store_n(&b->msk, m & ~(1ull << bit), __ATOMIC_RELEASE);
+  endWrite(b);
+  return true;
+}
+
+// Publishes a copy of the directory with b added (b != NULL) or the block at pos removed (b == NULL),
+// then frees the old one once no reader can be using it. Callers hold dirlock.
+static bool replaceDir(csa_mt* c, int pos, mtBlock* b) {
+  csa_mt_dir* d = c->dir;
+  int n = d->n + (b ? 1 : -1);
+  csa_mt_dir* nd = (csa_mt_dir*)malloc(sizeof(csa_mt_dir) + n * sizeof(mtBlock*));
+  if (!nd) return false;
+  nd->n = n;
+  memcpy(nd->b, d->b, pos * sizeof(mtBlock*));
+  if (b) {
+    nd->b[pos] = b;
+    memcpy(nd->b + pos + 1, d->b + pos, (d->n - pos) * sizeof(mtBlock*));
+  }
+  else memcpy(nd->b + pos, d->b + pos + 1, (d->n - pos - 1) * sizeof(mtBlock*));
+  __atomic_store_n(&c->dir, nd, __ATOMIC_SEQ_CST);
+  synchronize(c);
+  free(d);
+  return true;
+}
+
+csa_mt* csa_mt_init(void) {
+  csa_mt* c = (csa_mt*)calloc(1, sizeof(csa_mt));
+  if (!c) return NULL;
+  if (!(c->dir = (csa_mt_dir*)calloc(1, sizeof(csa_mt_dir)))) {
+    free(c);
+    return NULL;
+  }
+  pthread_mutex_init(&c->dirlock, NULL);
+  for (int s = 0; s < CSA_MT_STRIPES; s++) pthread_mutex_init(&c->stripes[s], NULL);
+  return c;
+}
+
+bool csa_mt_get(csa_mt* c, int idx, int* n) {
+  if (!c || !n || idx < 0) return false;
+  unsigned long e;
+  int stripe = readLock(c, &e);
+  mtBlock* b = findBlock(currentDir(c), idx);
+  bool found = b && readCell(b, idx % MSKLEN, n);
+  readUnlock(c, stripe, e);
+  return found;
+}
+
+// idx's block doesn't exist yet (or didn't when we looked) - make it under the directory lock
+static bool addBlock(csa_mt* c, int idx, int val) {
+  pthread_mutex_lock(&c->dirlock);
+  int pos = findPos(c->dir, idx);
+  bool ok = true;
+  if (pos < c->dir->n && c->dir->b[pos]->offset == blockOffset(idx)) {
+    // Someone else made it first - blocks are only unlinked under dirlock, so it's live
+    mtBlock* b = c->dir->b[pos];
+    pthread_mutex_lock(stripeLock(c, b));
+    putCell(b, idx % MSKLEN, val);
+    pthread_mutex_unlock(stripeLock(c, b));
+  }
+  else {
+    mtBlock* b = (mtBlock*)calloc(1, sizeof(mtBlock));
+    if (b) {
+      b->offset = blockOffset(idx);
+      b->msk = 1ull << (idx % MSKLEN);
+      b->vals[0] = val;
+    }
+    if (!b || !replaceDir(c, pos, b)) {
+      free(b);
+      ok = false;
+    }
+  }
+  pthread_mutex_unlock(&c->dirlock);
+  return ok;
+}
+
+bool csa_mt_set(csa_mt* c, int idx, int val) {
+  if (!c || idx < 0) return false;
+  for (;;) {
+    unsigned long e;
+    int stripe = readLock(c, &e);
+    mtBlock* b = findBlock(currentDir(c), idx);
+    if (!b) {
+      readUnlock(c, stripe, e);
+      return addBlock(c, idx, val);
+    }
+    pthread_mutex_lock(stripeLock(c, b));
+    bool dead = __atomic_load_n(&b->dead, __ATOMIC_RELAXED);
+    if (!dead) putCell(b, idx % MSKLEN, val);
+    pthread_mutex_unlock(stripeLock(c, b));
+    readUnlock(c, stripe, e);
+    // A dead block was emptied & unlinked while we waited for its lock - look again
+    if (!dead) return true;
+  }
+}
+
+// Unlinks idx's block if it is (still) empty
+static void dropIfEmpty(csa_mt* c, int idx) {
+  pthread_mutex_lock(&c->dirlock);
+  int pos = findPos(c->dir, idx);
+  if (pos < c->dir->n && c->dir->b[pos]->offset == blockOffset(idx)) {
+    mtBlock* b = c->dir->b[pos];
+    pthread_mutex_lock(stripeLock(c, b));
+    bool empty = (__atomic_load_n(&b->msk, __ATOMIC_RELAXED) == 0);
+    if (empty) __atomic_store_n(&b->dead, true, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(stripeLock(c, b));
+    if (empty) {
+      if (replaceDir(c, pos, NULL)) free(b);
+      else __atomic_store_n(&b->dead, false, __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&c->dirlock);
+}
+
+bool csa_mt_delete(csa_mt* c, int idx) {
+  if (!c || idx < 0) return false;
+  for (;;) {
+    unsigned long e;
+    int stripe = readLock(c, &e);
+    mtBlock* b = findBlock(currentDir(c), idx);
+    if (!b) {
+      readUnlock(c, stripe, e);
+      return false;
+    }
+    pthread_mutex_lock(stripeLock(c, b));
+    bool dead = __atomic_load_n(&b->dead, __ATOMIC_RELAXED);
+    bool removed = !dead && removeCell(b, idx % MSKLEN);
+    bool empty = removed && (__atomic_load_n(&b->msk, __ATOMIC_RELAXED) == 0);
+    pthread_mutex_unlock(stripeLock(c, b));
+    readUnlock(c, stripe, e);
+    if (dead) continue;
+    if (empty) dropIfEmpty(c, idx);
+    return removed;
+  }
+}
+
+int csa_mt_count(csa_mt* c) {
+  if (!c) return 0;
+  unsigned long e;
+  int stripe = readLock(c, &e);
+  csa_mt_dir* d = currentDir(c);
+  int count = 0;
+  for (int i = 0; i < d->n; i++) count += __builtin_popcountll(readBlock(d->b[i], NULL));
+  readUnlock(c, stripe, e);
+  return count;
+}
+
+void csa_mt_tostring(csa_mt* c, char* s) {
+  if (!c || !s) return;
+  char* blocks = (char*)calloc(BIGSTR, 1);
+  if (!blocks) return;
+  unsigned long e;
+  int stripe = readLock(c, &e);
+  csa_mt_dir* d = currentDir(c);
+  int vals[MSKLEN], shown = 0;
+  for (int i = 0; i < d->n; i++) {
+    block copy = {.vals = vals, .msk = readBlock(d->b[i], vals), .offset = d->b[i]->offset, .cap = MSKLEN};
+    // Emptied but not unlinked yet - csa would already have dropped it
+    if (!copy.msk) continue;
+    printBlock(&copy, blocks);
+    shown++;
+  }
+  readUnlock(c, stripe, e);
+  snprintf(s, BIGSTR, "%d block%s%s", shown, (shown == 1) ? " " : ((shown == 0) ? "s" : "s "), blocks);
+  free(blocks);
+}
+
+void csa_mt_free(csa_mt** l) {
+  if (!*l) return;
+  for (int i = 0; i < (*l)->dir->n; i++) free((*l)->dir->b[i]);
+  free((*l)->dir);
+  pthread_mutex_destroy(&(*l)->dirlock);
+  for (int s = 0; s < CSA_MT_STRIPES; s++) pthread_mutex_destroy(&(*l)->stripes[s]);
+  free(*l);
+  *l = NULL;
+}
@@ -0,0 +1,48 @@
+#pragma once
+// A CSA that many threads can use at once, with the same calls as csa.h.
+// Readers never take a lock: the block directory is read-copy-update - a
+// writer that adds or drops a block publishes a new copy and frees the old
+// one only once every reader that might have seen it is done - and each
+// block's values are read under a sequence counter, retrying if a writer
+// got in the way. Writers to existing blocks take one of a set of striped
+// locks; writers that change the directory are serialised by a mutex.
+// Build with -pthread.
+#include <pthread.h>
+#include "csa.h"
+
+#define CSA_MT_STRIPES 64
+
+typedef struct csa_mt_dir csa_mt_dir;
+
+// Each stripe of reader counts sits on its own cache line
+struct csa_mt_readers {
+   unsigned long count[2];
+   char pad[64 - 2 * sizeof(unsigned long)];
+};
+
+struct csa_mt {
+   csa_mt_dir* dir;
+   pthread_mutex_t dirlock;
+   pthread_mutex_t stripes[CSA_MT_STRIPES];
+   // Readers count themselves in on the side of epoch they started in
+   unsigned long epoch;
+   struct csa_mt_readers readers[CSA_MT_STRIPES];
+};
+typedef struct csa_mt csa_mt;
+
+csa_mt* csa_mt_init(void);
+
+// As csa_set/csa_get/csa_delete, and safe to call from any number of threads
+bool csa_mt_set(csa_mt* c, int idx, int val);
+bool csa_mt_get(csa_mt* c, int idx, int* n);
+bool csa_mt_delete(csa_mt* c, int idx);
+
+// Number of values stored - exact only while no other thread is writing
+int csa_mt_count(csa_mt* c);
+
+// As csa_tostring - a consistent picture of each block, though not of the
+// whole array if other threads are writing
+void csa_mt_tostring(csa_mt* c, char* s);
+
+// Usage : csa_mt_free(&c), once no other thread is using c
+void csa_mt_free(csa_mt** l);
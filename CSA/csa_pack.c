@@ -0,0 +1,217 @@
+#include "csa_pack.h"
+#include "mydefs.h"
+
+typedef struct {
+  mask_t msk;
+  // Byte position of the block's values in data - past 4GB on big arrays
+  size_t pos;
+  unsigned int offset;
+  // for : the smallest value, delta : the first value
+  int base;
+  // delta : the smallest difference (mod 2^32)
+  unsigned int step;
+  unsigned char enc;
+  // Bits per packed value
+  unsigned char width;
+} packedBlock;
+
+struct csa_packed {
+  packedBlock* b;
+  int n;
+  // Packed values, with a word of slack at the end so reads never run off it
+  unsigned char* data;
+  size_t len;
+};
+
+// Bits needed for any number up to r
+static int bitsFor(uint64_t r) { return r ? 64 - __builtin_clzll(r) : 0; }
+
+static void storeWord(unsigned char* d, uint64_t w) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  memcpy(d, &w, sizeof(w));
+}
+
+// The i'th width-bit value packed from d - width is at most 32, so it always sits within one 64-bit load
+static uint32_t unpackAt(const unsigned char* d, int i, int width) {
+  uint64_t bit = (uint64_t)i * width;
+  return (uint32_t)((loadWord(d + (bit >> 3)) >> (bit & 7)) & ((1ull << width) - 1));
+}
+
+static void packAt(unsigned char* d, int i, int width, uint32_t v) {
+  uint64_t bit = (uint64_t)i * width;
+  storeWord(d + (bit >> 3), loadWord(d + (bit >> 3)) | ((uint64_t)v << (bit & 7)));
+}
+
+static size_t packedBytes(int count, int width) { return ((size_t)count * width + 7) / 8; }
+
+// Picks how to store count values (forced to e unless it's auto), filling in b's
+// encoding, width, base & step, and returns the bytes needed
+static size_t chooseEncoding(const int* v, int count, csa_encoding e, packedBlock* b) {
+  long long mn = v[0], mx = v[0], dmn = 0, dmx = 0;
+  for (int i = 1; i < count; i++) {
+    mn = (v[i] < mn) ? v[i] : mn;
+    mx = (v[i] > mx) ? v[i] : mx;
+    long long d = (long long)v[i] - v[i - 1];
+    dmn = (i == 1 || d < dmn) ? d : dmn;
+    dmx = (i == 1 || d > dmx) ? d : dmx;
+  }
+  size_t raw = (size_t)count * sizeof(int);
+  size_t forBytes = packedBytes(count, bitsFor((uint64_t)(mx - mn)));
+  // Differences span up to 2^33, which may not pack into 32 bits
+  bool deltaFits = bitsFor((uint64_t)(dmx - dmn)) <= 32;
+  size_t deltaBytes = deltaFits ? packedBytes(count - 1, bitsFor((uint64_t)(dmx - dmn))) : SIZE_MAX;
+  if (e == csa_enc_auto) {
+    // Ties go to whichever decodes fastest
+    e = csa_enc_raw;
+    if (forBytes < raw) e = csa_enc_for;
+    if (deltaBytes < ((e == csa_enc_for) ? forBytes : raw)) e = csa_enc_delta;
+  }
+  if (e == csa_enc_delta && !deltaFits) e = csa_enc_for;
+  b->enc = (unsigned char)e;
+  switch (e) {
+    case csa_enc_for:
+      b->base = (int)mn;
+      b->width = (unsigned char)bitsFor((uint64_t)(mx - mn));
+      return forBytes;
+    case csa_enc_delta:
+      b->base = v[0];
+      b->step = (unsigned int)dmn;
+      b->width = (unsigned char)bitsFor((uint64_t)(dmx - dmn));
+      return deltaBytes;
+    default:
+      b->width = 32;
+      return raw;
+  }
+}
+
+static void encodeBlock(const int* v, int count, const packedBlock* b, unsigned char* d) {
+  switch (b->enc) {
+    case csa_enc_for:
+      for (int i = 0; i < count; i++) packAt(d, i, b->width, (uint32_t)v[i] - (uint32_t)b->base);
+      break;
+    case csa_enc_delta:
+      for (int i = 1; i < count; i++) packAt(d, i - 1, b->width, (uint32_t)v[i] - (uint32_t)v[i - 1] - b->step);
+      break;
+    default:
+      memcpy(d, v, count * sizeof(int));
+  }
+}
+
+// All of a block's values, in index order. The unpacking is k's; a delta block then
+// adds up its differences, one add per value.
+static void decodeBlock(const csaKernels* k, csa_packed* p, const packedBlock* b, int* out) {
+  const unsigned char* d = p->data + b->pos;
+  int count = __builtin_popcountll(b->msk);
+  switch (b->enc) {
+    case csa_enc_for:
+      k->unpack(d, count, b->width, b->base, out);
+      break;
+    case csa_enc_delta:
+      out[0] = b->base;
+      k->unpack(d, count - 1, b->width, (int)b->step, out + 1);
+      for (int i = 1; i < count; i++) out[i] = (int)((uint32_t)out[i - 1] + (uint32_t)out[i]);
+      break;
+    default:
+      memcpy(out, d, count * sizeof(int));
+  }
+}
+
+csa_packed* csa_pack(csa* c, csa_encoding e) {
+  if (!c) return NULL;
+  csa_packed* p = (csa_packed*)calloc(1, sizeof(csa_packed));
+  if (!p || (c->n && !(p->b = (packedBlock*)malloc(c->n * sizeof(packedBlock))))) {
+    csa_packed_free(&p);
+    return NULL;
+  }
+  block view;
+  size_t len = 0;
+  for (int blk = 0; blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    p->b[blk] = (packedBlock){.msk = b->msk, .offset = b->offset, .pos = len};
+    len += chooseEncoding(b->vals, __builtin_popcountll(b->msk), e, &(p->b[blk]));
+  }
+  p->n = c->n;
+  p->len = len + sizeof(uint64_t);
+  if (!(p->data = (unsigned char*)calloc(p->len, 1))) {
+    csa_packed_free(&p);
+    return NULL;
+  }
+  for (int blk = 0; blk < c->n; blk++) {
+    block* b = blockAt(c, blk, &view);
+    encodeBlock(b->vals, __builtin_popcountll(b->msk), &(p->b[blk]), p->data + p->b[blk].pos);
+  }
+  return p;
+}
+
+bool csa_packed_get(csa_packed* p, int idx, int* n) {
+  if (!p || !n || idx < 0) return false;
+  int lo = 0, hi = p->n;
+  while (lo < hi) {
+    int mid = lo + ((hi - lo) >> 1);
+    if (p->b[mid].offset < blockOffset(idx)) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo == p->n || p->b[lo].offset != blockOffset(idx) || !(p->b[lo].msk & (1ull << (idx % MSKLEN)))) return false;
+  const packedBlock* b = &(p->b[lo]);
+  const unsigned char* d = p->data + b->pos;
+  int v = __builtin_popcountll(b->msk & ((1ull << (idx % MSKLEN)) - 1));
+  if (b->enc == csa_enc_for) *n = (int)((uint32_t)b->base + unpackAt(d, v, b->width));
+  else if (b->enc == csa_enc_delta) {
+    uint32_t acc = (uint32_t)b->base + (uint32_t)v * b->step;
+    for (int i = 0; i < v; i++) acc += unpackAt(d, i, b->width);
+    *n = (int)acc;
+  }
+  else memcpy(n, d + v * sizeof(int), sizeof(int));
+  return true;
+}
+
+int csa_packed_count(csa_packed* p) {
+  int count = 0;
+  for (int blk = 0; p && blk < p->n; blk++) count += __builtin_popcountll(p->b[blk].msk);
+  return count;
+}
+
+long long csa_packed_sum(csa_packed* p) {
+  long long sum = 0;
+  int vals[MSKLEN];
+  const csaKernels* k = simdKernels();
+  for (int blk = 0; p && blk < p->n; blk++) {
+    decodeBlock(k, p, &(p->b[blk]), vals);
+    sum += k->sum(vals, __builtin_popcountll(p->b[blk].msk));
+  }
+  return sum;
+}
+
+csa* csa_unpack(csa_packed* p) {
+  if (!p) return NULL;
+  csa* c = csa_init();
+  const csaKernels* k = simdKernels();
+  if (!c || (p->n && !resizeBlocks(c, p->n))) {
+    csa_free(&c);
+    return NULL;
+  }
+  for (int blk = 0; blk < p->n; blk++) {
+    unsigned int count = __builtin_popcountll(p->b[blk].msk);
+    unsigned int cap = valCapacity(c->policy, 0, count);
+    int* vals = (int*)malloc(cap * sizeof(int));
+    if (!vals) {
+      csa_free(&c);
+      return NULL;
+    }
+    decodeBlock(k, p, &(p->b[blk]), vals);
+    c->b[(c->n)++] = (block){.vals = vals, .msk = p->b[blk].msk, .offset = p->b[blk].offset, .cap = cap};
+  }
+  return c;
+}
+
+size_t csa_packed_bytes(csa_packed* p) { return p ? sizeof(csa_packed) + p->n * sizeof(packedBlock) + p->len : 0; }
+
+void csa_packed_free(csa_packed** p) {
+  if (!*p) return;
+  free((*p)->b);
+  free((*p)->data);
+  free(*p);
+  *p = NULL;
+}
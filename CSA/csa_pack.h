@@ -0,0 +1,43 @@
+#pragma once
+// A read-only, compressed copy of a CSA. Each block's values are kept whichever
+// of these ways is smallest for that block (or all one way, for comparison) :
+//    raw   : plain ints
+//    for   : frame of reference - the block's smallest value, then how far each
+//            value is above it, in just enough bits for the biggest gap
+//    delta : the first value, then the difference from one value to the next,
+//            frame-of-reference packed the same way
+// Small values, or ones that grow steadily with the index (counters, sorted
+// tables), shrink to a few bits each.
+#include "csa.h"
+
+typedef enum {
+   csa_enc_auto,
+   csa_enc_raw,
+   csa_enc_for,
+   csa_enc_delta
+} csa_encoding;
+
+typedef struct csa_packed csa_packed;
+
+// Packs what c holds now (c itself is left alone).
+// Returns NULL if c is NULL or memory runs out.
+csa_packed* csa_pack(csa* c, csa_encoding e);
+
+// As csa_get. Raw & frame-of-reference blocks decode one value; a delta block
+// adds up the differences before it.
+bool csa_packed_get(csa_packed* p, int idx, int* n);
+
+int csa_packed_count(csa_packed* p);
+
+// As csa_sum - each block is unpacked whole (8 values at a time with AVX2),
+// then summed with the SIMD kernels
+long long csa_packed_sum(csa_packed* p);
+
+// A normal, writable CSA with the same contents, or NULL if memory runs out
+csa* csa_unpack(csa_packed* p);
+
+// Everything p takes up, headers included
+size_t csa_packed_bytes(csa_packed* p);
+
+// Usage : csa_packed_free(&p)
+void csa_packed_free(csa_packed** p);
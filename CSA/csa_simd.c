@@ -0,0 +1,286 @@
+// Kernels over a contiguous run of values - every block's vals is one of these.
+// Picked at runtime: AVX2 or SSE4.1 on x86 CPUs that have them, plain C otherwise.
+#include "csa.h"
+#include "mydefs.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CSA_X86
+#include <immintrin.h>
+#endif
+
+static long long sumScalar(const int* v, int n) {
+  long long s = 0;
+  for (int i = 0; i < n; i++) s += v[i];
+  return s;
+}
+
+// Wraps on overflow, like the vector versions, rather than being undefined
+static void scaleScalar(int* v, int n, int k) { for (int i = 0; i < n; i++) v[i] = (int)((unsigned int)v[i] * (unsigned int)k); }
+
+static void addScalar(int* v, int n, int k) { for (int i = 0; i < n; i++) v[i] = (int)((unsigned int)v[i] + (unsigned int)k); }
+
+static int minScalar(const int* v, int n) {
+  int m = v[0];
+  for (int i = 1; i < n; i++) m = (v[i] < m) ? v[i] : m;
+  return m;
+}
+
+static int maxScalar(const int* v, int n) {
+  int m = v[0];
+  for (int i = 1; i < n; i++) m = (v[i] > m) ? v[i] : m;
+  return m;
+}
+
+static long long dotScalar(const int* a, const int* b, int n) {
+  long long s = 0;
+  for (int i = 0; i < n; i++) s += (long long)a[i] * b[i];
+  return s;
+}
+
+uint64_t loadWord(const unsigned char* d) {
+  uint64_t w;
+  memcpy(&w, d, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+
+// A width-bit number and its shift into the byte always fit in one 64-bit load
+static void unpackScalar(const unsigned char* d, int n, int width, int base, int* out) {
+  uint64_t m = (1ull << width) - 1;
+  for (int i = 0; i < n; i++) {
+    uint64_t bit = (uint64_t)i * width;
+    out[i] = (int)((uint32_t)base + (uint32_t)((loadWord(d + (bit >> 3)) >> (bit & 7)) & m));
+  }
+}
+
+static const csaKernels scalarKernels = {"scalar", sumScalar, scaleScalar, addScalar, minScalar, maxScalar, dotScalar, unpackScalar};
+
+#ifdef CSA_X86
+static __attribute__((target("sse4.1"))) long long sumSse(const int* v, int n) {
+  __m128i acc = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(v + i));
+    acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(x));
+    acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(_mm_srli_si128(x, 8)));
+  }
+  long long lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  return lanes[0] + lanes[1] + sumScalar(v + i, n - i);
+}
+
+static __attribute__((target("sse4.1"))) void scaleSse(int* v, int n, int k) {
+  __m128i kk = _mm_set1_epi32(k);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(v + i), _mm_mullo_epi32(_mm_loadu_si128((__m128i*)(v + i)), kk));
+  scaleScalar(v + i, n - i, k);
+}
+
+static __attribute__((target("sse4.1"))) void addSse(int* v, int n, int k) {
+  __m128i kk = _mm_set1_epi32(k);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(v + i), _mm_add_epi32(_mm_loadu_si128((__m128i*)(v + i)), kk));
+  addScalar(v + i, n - i, k);
+}
+
+static __attribute__((target("sse4.1"))) int minSse(const int* v, int n) {
+  if (n < 4) return minScalar(v, n);
+  __m128i m = _mm_loadu_si128((const __m128i*)v);
+  int i = 4;
+  for (; i + 4 <= n; i += 4) m = _mm_min_epi32(m, _mm_loadu_si128((const __m128i*)(v + i)));
+  int lanes[4];
+  _mm_storeu_si128((__m128i*)lanes, m);
+  int best = minScalar(lanes, 4);
+  if (i < n) {
+    int rest = minScalar(v + i, n - i);
+    best = (rest < best) ? rest : best;
+  }
+  return best;
+}
+
+static __attribute__((target("sse4.1"))) int maxSse(const int* v, int n) {
+  if (n < 4) return maxScalar(v, n);
+  __m128i m = _mm_loadu_si128((const __m128i*)v);
+  int i = 4;
+  for (; i + 4 <= n; i += 4) m = _mm_max_epi32(m, _mm_loadu_si128((const __m128i*)(v + i)));
+  int lanes[4];
+  _mm_storeu_si128((__m128i*)lanes, m);
+  int best = maxScalar(lanes, 4);
+  if (i < n) {
+    int rest = maxScalar(v + i, n - i);
+    best = (rest > best) ? rest : best;
+  }
+  return best;
+}
+
+// _mm_mul_epi32 multiplies the even lanes into 64 bits, so the odd lanes are shifted down to meet it
+static __attribute__((target("sse4.1"))) long long dotSse(const int* a, const int* b, int n) {
+  __m128i acc = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+    acc = _mm_add_epi64(acc, _mm_mul_epi32(x, y));
+    acc = _mm_add_epi64(acc, _mm_mul_epi32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32)));
+  }
+  long long lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  return lanes[0] + lanes[1] + dotScalar(a + i, b + i, n - i);
+}
+
+static __attribute__((target("avx2"))) long long sumAvx2(const int* v, int n) {
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(v + i));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+  }
+  long long lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumScalar(v + i, n - i);
+}
+
+static __attribute__((target("avx2"))) void scaleAvx2(int* v, int n, int k) {
+  __m256i kk = _mm256_set1_epi32(k);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i*)(v + i), _mm256_mullo_epi32(_mm256_loadu_si256((__m256i*)(v + i)), kk));
+  scaleScalar(v + i, n - i, k);
+}
+
+static __attribute__((target("avx2"))) void addAvx2(int* v, int n, int k) {
+  __m256i kk = _mm256_set1_epi32(k);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i*)(v + i), _mm256_add_epi32(_mm256_loadu_si256((__m256i*)(v + i)), kk));
+  addScalar(v + i, n - i, k);
+}
+
+static __attribute__((target("avx2"))) int minAvx2(const int* v, int n) {
+  if (n < 8) return minSse(v, n);
+  __m256i m = _mm256_loadu_si256((const __m256i*)v);
+  int i = 8;
+  for (; i + 8 <= n; i += 8) m = _mm256_min_epi32(m, _mm256_loadu_si256((const __m256i*)(v + i)));
+  int lanes[8];
+  _mm256_storeu_si256((__m256i*)lanes, m);
+  int best = minScalar(lanes, 8);
+  if (i < n) {
+    int rest = minScalar(v + i, n - i);
+    best = (rest < best) ? rest : best;
+  }
+  return best;
+}
+
+static __attribute__((target("avx2"))) int maxAvx2(const int* v, int n) {
+  if (n < 8) return maxSse(v, n);
+  __m256i m = _mm256_loadu_si256((const __m256i*)v);
+  int i = 8;
+  for (; i + 8 <= n; i += 8) m = _mm256_max_epi32(m, _mm256_loadu_si256((const __m256i*)(v + i)));
+  int lanes[8];
+  _mm256_storeu_si256((__m256i*)lanes, m);
+  int best = maxScalar(lanes, 8);
+  if (i < n) {
+    int rest = maxScalar(v + i, n - i);
+    best = (rest > best) ? rest : best;
+  }
+  return best;
+}
+
+static __attribute__((target("avx2"))) long long dotAvx2(const int* a, const int* b, int n) {
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(x, y));
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(y, 32)));
+  }
+  long long lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotScalar(a + i, b + i, n - i);
+}
+
+// Every 8 numbers take exactly width bytes, so each lane reads from & shifts by the same
+// amounts for every 8 : one gather, a shift & a mask unpack them. Up to 25 bits, a number
+// & its shift fit in a 32-bit lane; wider ones are gathered as two lots of 64 bits.
+static __attribute__((target("avx2"))) void unpackAvx2(const unsigned char* d, int n, int width, int base, int* out) {
+  int at[8], shift[8];
+  for (int j = 0; j < 8; j++) {
+    at[j] = (j * width) >> 3;
+    shift[j] = (j * width) & 7;
+  }
+  __m256i bb = _mm256_set1_epi32(base);
+  int i = 0;
+  if (width <= 25) {
+    __m256i idx = _mm256_loadu_si256((const __m256i*)at);
+    __m256i sh = _mm256_loadu_si256((const __m256i*)shift);
+    __m256i m = _mm256_set1_epi32((int)((1u << width) - 1));
+    for (; i + 8 <= n; i += 8, d += width) {
+      __m256i x = _mm256_i32gather_epi32((const int*)d, idx, 1);
+      _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi32(_mm256_and_si256(_mm256_srlv_epi32(x, sh), m), bb));
+    }
+  }
+  else {
+    __m128i lo = _mm_loadu_si128((const __m128i*)at), hi = _mm_loadu_si128((const __m128i*)(at + 4));
+    __m256i shLo = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)shift));
+    __m256i shHi = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(shift + 4)));
+    __m256i m = _mm256_set1_epi64x((long long)((1ull << width) - 1));
+    // The low halves of the 64-bit lanes, in order
+    __m256i evens = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    for (; i + 8 <= n; i += 8, d += width) {
+      __m256i x = _mm256_and_si256(_mm256_srlv_epi64(_mm256_i32gather_epi64((const long long*)d, lo, 1), shLo), m);
+      __m256i y = _mm256_and_si256(_mm256_srlv_epi64(_mm256_i32gather_epi64((const long long*)d, hi, 1), shHi), m);
+      x = _mm256_permutevar8x32_epi32(x, evens);
+      y = _mm256_permutevar8x32_epi32(y, evens);
+      __m256i v = _mm256_inserti128_si256(x, _mm256_castsi256_si128(y), 1);
+      _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi32(v, bb));
+    }
+  }
+  // Each 8 starts on a byte, so the rest unpacks from d as if it were the start
+  unpackScalar(d, n - i, width, base, out + i);
+}
+
+// SSE4.1 has no gathers or per-lane shifts, so it unpacks as the scalar code does
+static const csaKernels sseKernels = {"sse4.1", sumSse, scaleSse, addSse, minSse, maxSse, dotSse, unpackScalar};
+static const csaKernels avx2Kernels = {"avx2", sumAvx2, scaleAvx2, addAvx2, minAvx2, maxAvx2, dotAvx2, unpackAvx2};
+#endif
+
+// Read by any thread on every query, so always loaded & stored atomically
+static const csaKernels* chosen = NULL;
+
+// Best kernels this CPU can run
+static const csaKernels* bestKernels(void) {
+#ifdef CSA_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return &avx2Kernels;
+  if (__builtin_cpu_supports("sse4.1")) return &sseKernels;
+#endif
+  return &scalarKernels;
+}
+
+const csaKernels* simdKernels(void) {
+  const csaKernels* k = __atomic_load_n(&chosen, __ATOMIC_ACQUIRE);
+  if (k) return k;
+  // Racing threads all work out the same table, & only the first one's store sticks
+  const csaKernels* none = NULL;
+  k = bestKernels();
+  return __atomic_compare_exchange_n(&chosen, &none, k, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ? k : none;
+}
+
+bool csa_simd_select(const char* name) {
+#ifdef CSA_X86
+  __builtin_cpu_init();
+#endif
+  const csaKernels* k = NULL;
+  if (!name) k = bestKernels();
+  else if (strcmp(name, scalarKernels.name) == 0) k = &scalarKernels;
+#ifdef CSA_X86
+  else if (strcmp(name, sseKernels.name) == 0 && __builtin_cpu_supports("sse4.1")) k = &sseKernels;
+  else if (strcmp(name, avx2Kernels.name) == 0 && __builtin_cpu_supports("avx2")) k = &avx2Kernels;
+#endif
+  if (k) __atomic_store_n(&chosen, k, __ATOMIC_RELEASE);
+  return k != NULL;
+}
+
+const char* csa_simd_name(void) { return simdKernels()->name; }
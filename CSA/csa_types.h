@@ -0,0 +1,12 @@
+#pragma once
+// Ready-made CSAs of other element types - see csa_gen.h to make more.
+
+// csa_i64 : 64-bit integers
+#define CSA_NAME csa_i64
+#define CSA_TYPE int64_t
+#include "csa_gen.h"
+
+// csa_f64 : doubles
+#define CSA_NAME csa_f64
+#define CSA_TYPE double
+#include "csa_gen.h"
@@ -0,0 +1,212 @@
+#include "csa_wide.h"
+#include "mydefs.h"
+
+static const int widths[] = {64, 128, 256, 512};
+#define NUMWIDTHS (int)(sizeof(widths) / sizeof(widths[0]))
+
+static unsigned int wideOffset(csa_wide* c, int idx) { return (unsigned int)(idx / c->width) * c->width; }
+
+// Index of the first block whose offset is not below idx's block, or c->n if there is none
+static int wideIndex(csa_wide* c, int idx) {
+  int lo = 0, hi = c->n;
+  while (lo < hi) {
+    int mid = lo + ((hi - lo) >> 1);
+    if (c->b[mid].offset < wideOffset(c, idx)) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static bool wideHas(csa_wide* c, int blk, int bit) { return c->msk[blk * c->words + (bit >> 6)] & (1ull << (bit & 63)); }
+
+// Where bit's value sits in block blk's vals
+static int wideRank(csa_wide* c, int blk, int bit) {
+  int w = blk * c->words + (bit >> 6);
+  return c->before[w] + __builtin_popcountll(c->msk[w] & ((1ull << (bit & 63)) - 1));
+}
+
+static int wideCount(csa_wide* c, int blk) {
+  int last = (blk + 1) * c->words - 1;
+  return c->before[last] + __builtin_popcountll(c->msk[last]);
+}
+
+// Sets or clears bit in block blk's mask, keeping the later words' counts right
+static void wideFlip(csa_wide* c, int blk, int bit, bool on) {
+  int w = blk * c->words + (bit >> 6);
+  if (on) c->msk[w] |= 1ull << (bit & 63);
+  else c->msk[w] &= ~(1ull << (bit & 63));
+  for (int j = w + 1; j < (blk + 1) * c->words; j++) c->before[j] += on ? 1 : -1;
+}
+
+// Moves the directory to arrays of cap blocks. If one realloc() fails the others may already
+// have moved, so only the smaller of the old & new sizes is then safe to use.
+static bool wideResize(csa_wide* c, int cap) {
+  wideBlock* b = (wideBlock*)realloc(c->b, cap * sizeof(wideBlock));
+  mask_t* msk = b ? (mask_t*)realloc(c->msk, cap * c->words * sizeof(mask_t)) : NULL;
+  uint16_t* before = msk ? (uint16_t*)realloc(c->before, cap * c->words * sizeof(uint16_t)) : NULL;
+  if (b) c->b = b;
+  if (msk) c->msk = msk;
+  if (before) c->before = before;
+  c->cap = (before || cap < c->cap) ? cap : c->cap;
+  return before != NULL;
+}
+
+// Shifts blocks from blk onwards by one place - up (to open a gap at blk) or down (over blk)
+static void wideShift(csa_wide* c, int blk, bool up) {
+  int from = up ? blk : blk + 1, to = up ? blk + 1 : blk, count = c->n - from;
+  memmove(c->b + to, c->b + from, count * sizeof(wideBlock));
+  memmove(c->msk + to * c->words, c->msk + from * c->words, count * c->words * sizeof(mask_t));
+  memmove(c->before + to * c->words, c->before + from * c->words, count * c->words * sizeof(uint16_t));
+}
+
+static bool wideNewBlock(csa_wide* c, int blk, int idx, int val) {
+  if (c->n == c->cap && !wideResize(c, c->cap ? c->cap * 2 : 1)) return false;
+  int* vals = (int*)malloc(sizeof(int));
+  if (!vals) return false;
+  wideShift(c, blk, true);
+  *vals = val;
+  c->b[blk] = (wideBlock){.vals = vals, .offset = wideOffset(c, idx), .cap = 1};
+  memset(c->msk + blk * c->words, 0, c->words * sizeof(mask_t));
+  memset(c->before + blk * c->words, 0, c->words * sizeof(uint16_t));
+  c->n++;
+  wideFlip(c, blk, idx % c->width, true);
+  return true;
+}
+
+static bool wideAddVal(csa_wide* c, int blk, int bit, int val) {
+  wideBlock* b = &(c->b[blk]);
+  int v = wideRank(c, blk, bit);
+  if (wideHas(c, blk, bit)) return ((b->vals[v] = val) || true);
+  unsigned int count = wideCount(c, blk);
+  if (count == b->cap) {
+    unsigned int cap = (b->cap * 2 > (unsigned int)c->width) ? (unsigned int)c->width : b->cap * 2;
+    int* temp = (int*)realloc(b->vals, cap * sizeof(int));
+    if (!temp) return false;
+    b->vals = temp;
+    b->cap = cap;
+  }
+  memmove(b->vals + v + 1, b->vals + v, (count - v) * sizeof(int));
+  b->vals[v] = val;
+  wideFlip(c, blk, bit, true);
+  return true;
+}
+
+csa_wide* csa_wide_init(int width) {
+  bool ok = false;
+  for (int i = 0; i < NUMWIDTHS; i++) ok |= (width == widths[i]);
+  if (!ok) return NULL;
+  csa_wide* c = (csa_wide*)calloc(1, sizeof(csa_wide));
+  if (!c) return NULL;
+  c->width = width;
+  c->words = width / 64;
+  return c;
+}
+
+bool csa_wide_set(csa_wide* c, int idx, int val) {
+  if (!c || idx < 0) return false;
+  int blk = wideIndex(c, idx);
+  return ((blk == c->n) || (c->b[blk].offset != wideOffset(c, idx))) ? wideNewBlock(c, blk, idx, val) : wideAddVal(c, blk, idx % c->width, val);
+}
+
+bool csa_wide_get(csa_wide* c, int idx, int* n) {
+  if (!c || !n || idx < 0) return false;
+  int blk = wideIndex(c, idx);
+  if (blk == c->n || c->b[blk].offset != wideOffset(c, idx) || !wideHas(c, blk, idx % c->width)) return false;
+  *n = c->b[blk].vals[wideRank(c, blk, idx % c->width)];
+  return true;
+}
+
+bool csa_wide_delete(csa_wide* c, int idx) {
+  if (!c || idx < 0) return false;
+  int blk = wideIndex(c, idx), bit = idx % c->width;
+  if (blk == c->n || c->b[blk].offset != wideOffset(c, idx) || !wideHas(c, blk, bit)) return false;
+  wideBlock* b = &(c->b[blk]);
+  int v = wideRank(c, blk, bit);
+  unsigned int count = wideCount(c, blk);
+  memmove(b->vals + v, b->vals + v + 1, (count - v - 1) * sizeof(int));
+  wideFlip(c, blk, bit, false);
+  if (--count) {
+    // As csa_balanced : halve once only a quarter is used
+    if (count <= b->cap / 4) {
+      int* temp = (int*)realloc(b->vals, (b->cap / 2) * sizeof(int));
+      if (temp) {
+        b->vals = temp;
+        b->cap /= 2;
+      }
+    }
+    return true;
+  }
+  free(b->vals);
+  wideShift(c, blk, false);
+  if (--(c->n) == 0) {
+    free(c->b);
+    free(c->msk);
+    free(c->before);
+    c->b = NULL;
+    c->msk = NULL;
+    c->before = NULL;
+    c->cap = 0;
+  }
+  else if (c->n <= c->cap / 4) wideResize(c, c->cap / 2);
+  return true;
+}
+
+int csa_wide_count(csa_wide* c) {
+  int count = 0;
+  for (int blk = 0; c && blk < c->n; blk++) count += wideCount(c, blk);
+  return count;
+}
+
+size_t csa_wide_bytes(csa_wide* c) {
+  if (!c) return 0;
+  size_t bytes = sizeof(csa_wide) + c->cap * (sizeof(wideBlock) + c->words * (sizeof(mask_t) + sizeof(uint16_t)));
+  for (int blk = 0; blk < c->n; blk++) bytes += c->b[blk].cap * sizeof(int);
+  return bytes;
+}
+
+int csa_wide_pick(csa* c) {
+  int best = widths[0];
+  size_t bestBytes = SIZE_MAX;
+  for (int i = 0; c && i < NUMWIDTHS; i++) {
+    // Values cost the same whatever the width, so only the block count matters
+    size_t blocks = 0;
+    long long last = -1;
+    for (int blk = 0; blk < c->n; blk++) {
+      long long off = offsetAt(c, blk) / widths[i];
+      blocks += (off != last);
+      last = off;
+    }
+    size_t bytes = blocks * (sizeof(wideBlock) + (widths[i] / 64) * (sizeof(mask_t) + sizeof(uint16_t)));
+    if (bytes < bestBytes) {
+      best = widths[i];
+      bestBytes = bytes;
+    }
+  }
+  return best;
+}
+
+csa_wide* csa_wide_from(csa* c, int width) {
+  if (!c) return NULL;
+  csa_wide* w = csa_wide_init(width ? width : csa_wide_pick(c));
+  if (!w) return NULL;
+  int idx, val;
+  // In index order, so every new block goes on the end
+  for (int from = 0; csa_next(c, from, &idx, &val); from = idx + 1) {
+    if (!csa_wide_set(w, idx, val)) {
+      csa_wide_free(&w);
+      return NULL;
+    }
+    if (idx == INT_MAX) break;
+  }
+  return w;
+}
+
+void csa_wide_free(csa_wide** l) {
+  if (!*l) return;
+  for (int blk = 0; blk < (*l)->n; blk++) free((*l)->b[blk].vals);
+  free((*l)->b);
+  free((*l)->msk);
+  free((*l)->before);
+  free(*l);
+  *l = NULL;
+}
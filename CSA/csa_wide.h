@@ -0,0 +1,52 @@
+#pragma once
+// A CSA whose blocks cover 64, 128, 256 or 512 indices instead of MSKLEN.
+// Wider blocks mean fewer block headers for dense data; narrower ones waste
+// less on mask bits for scattered data. A block's mask is kept as 64-bit words,
+// each with a count of the bits set in the words before it, so finding a
+// value's place is one lookup & one popcount however wide the block is.
+#include "csa.h"
+
+#define CSA_WIDE_MAX 512
+
+typedef struct {
+   int* vals;
+   unsigned int offset;
+   // Number of slots allocated in vals
+   unsigned int cap;
+} wideBlock;
+
+struct csa_wide {
+   // realloc-style arrays, all with room for cap blocks : block b's mask is
+   // msk[b*words] onwards, & before[b*words + j] is the popcount of its words before j
+   wideBlock* b;
+   mask_t* msk;
+   uint16_t* before;
+   int n;
+   int cap;
+   int width;
+   int words;
+};
+typedef struct csa_wide csa_wide;
+
+// width must be 64, 128, 256 or 512 - returns NULL otherwise
+csa_wide* csa_wide_init(int width);
+
+// As csa_set/csa_get/csa_delete
+bool csa_wide_set(csa_wide* c, int idx, int val);
+bool csa_wide_get(csa_wide* c, int idx, int* n);
+bool csa_wide_delete(csa_wide* c, int idx);
+
+int csa_wide_count(csa_wide* c);
+
+// Everything c takes up, headers included
+size_t csa_wide_bytes(csa_wide* c);
+
+// The width that would hold what c holds in the fewest bytes
+int csa_wide_pick(csa* c);
+
+// A copy of c with blocks width wide, or with csa_wide_pick(c)'s width if width
+// is 0. Returns NULL if c is NULL, width is invalid or memory runs out.
+csa_wide* csa_wide_from(csa* c, int width);
+
+// Usage : csa_wide_free(&c)
+void csa_wide_free(csa_wide** l);
@@ -5,6 +5,9 @@
 void sum(int* p, int* ac);
 void gap(int* p, int* ac);
 void dblit(int* p, int* ac);
+#ifdef CSA_STATS
+void print_stats(csa* c);
+#endif
 
 int main(void)
 {
@@ -109,6 +112,36 @@ int main(void)
    // csa structure itself should be in use by now ...
    free(c);
 #endif
+
+#ifdef CSA_STATS
+   // STATS : what a mixed workload did to an array
+   c = csa_init();
+   for(int i=0; i<20000; i++){
+      assert(csa_set(c, (i*37) % 10000, i));
+   }
+   for(int i=0; i<10000; i+=3){
+      csa_get(c, i, &n);
+   }
+#ifdef EXT
+   for(int i=0; i<10000; i+=5){
+      assert(csa_delete(c, i));
+   }
+#endif
+   print_stats(c);
+   csa_free(&c);
+
+   // STATS : an unsorted csa_set_many() counts each set once, & only lookups probe
+   struct csa_stats st;
+   int idx[3] = {500, 1, 300};
+   int val[3] = {5, 1, 3};
+   c = csa_init();
+   assert(csa_set_many(c, idx, val, 3));
+   assert(csa_stats(c, &st) && st.sets==3);
+   long long probes = st.probes;
+   assert(csa_next(c, 2, &n, NULL) && n==300);
+   assert(csa_stats(c, &st) && st.probes==probes);
+   csa_free(&c);
+#endif
    return EXIT_SUCCESS;
 }
 
@@ -135,3 +168,26 @@ void gap(int* p, int* ac)
    *ac = (int)(p - prv);
    prv = p;
 }
+
+#ifdef CSA_STATS
+void print_stats(csa* c)
+{
+   struct csa_stats st;
+   assert(csa_stats(c, &st));
+   printf("blocks    %d\n", st.blocks);
+   printf("segments  %d\n", st.segments);
+   printf("values    %d (%.1f per block)\n", st.values, st.blocks ? (double)st.values / st.blocks : 0.0);
+   printf("bytes     %zu (%.2f per value)\n", st.bytes, st.values ? (double)st.bytes / st.values : 0.0);
+   printf("fill      ");
+   for(int i=0; i<8; i++){
+      printf("<=%d/8:%d ", i+1, st.fill[i]);
+   }
+   printf("\n");
+   printf("gets      %lld\n", st.gets);
+   printf("sets      %lld\n", st.sets);
+   printf("deletes   %lld\n", st.deletes);
+   printf("probes    %lld (%.2f per lookup)\n", st.probes,
+          (st.gets + st.sets + st.deletes) ? (double)st.probes / (st.gets + st.sets + st.deletes) : 0.0);
+   printf("reallocs  %lld\n", st.reallocs);
+}
+#endif
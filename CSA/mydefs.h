@@ -2,10 +2,113 @@
 
 #define BIGSTR 100000
 
+// Bumps one of c's csa_stats() totals - nothing at all unless built with -DCSA_STATS
+#ifdef CSA_STATS
+#define CSA_STAT(c, total, n) ((c)->total += (n))
+#else
+#define CSA_STAT(c, total, n) ((void)0)
+#endif
+
+// Kernels over a run of n values (n >= 1), see csa_simd.c
+typedef struct {
+  const char* name;
+  long long (*sum)(const int* v, int n);
+  void (*scale)(int* v, int n, int k);
+  void (*add)(int* v, int n, int k);
+  int (*min)(const int* v, int n);
+  int (*max)(const int* v, int n);
+  long long (*dot)(const int* a, const int* b, int n);
+  // out[i] = base + the i'th width-bit number (width <= 32) packed little-endian
+  // from d, wrapping - d must have a word of slack after the last one
+  void (*unpack)(const unsigned char* d, int n, int width, int base, int* out);
+} csaKernels;
+
+const csaKernels* simdKernels(void);
+// The little-endian 64-bit word at d, unaligned - what unpack and csa_pack.c read packed values through
+uint64_t loadWord(const unsigned char* d);
+
+// Elementwise operations between two CSAs
+typedef enum {opAdd, opMul, opUnion, opIntersect} csaOp;
+
+// What csa_save() writes, in the saving machine's byte order : a csaFileHeader,
+// nblocks csaFileBlocks in offset order, then nvals ints
+#define CSA_FILE_MAGIC "CSAFILE1"
+typedef struct {
+  char magic[8];
+  uint64_t nblocks;
+  uint64_t nvals;
+} csaFileHeader;
+
+typedef struct {
+  mask_t msk;
+  uint32_t offset;
+  // Position of the block's first value among the file's values
+  uint32_t start;
+} csaFileBlock;
+
+// A file opened by csa_open_mmap()
+struct csa_map {
+  void* base;
+  size_t len;
+  const csaFileBlock* dir;
+  const int* vals;
+};
+
+void unmapFile(struct csa_map* m);
+
+// Where arena allocations start - enough for any of a CSA's arrays
+#define ARENA_ALIGN 16
+
+// malloc(), realloc() & free() for c's storage, going to c's arena if it has one.
+// An arena needs the old size to copy from, as it can't look it up.
+void* arenaAlloc(csa_arena* a, size_t size);
+void* csaAlloc(csa* c, size_t size);
+void* csaRealloc(csa* c, void* p, size_t old, size_t size);
+void csaRelease(csa* c, void* p);
+
+// Copy-on-write, see csa_snapshot()
+bool isShared(int* refs);
+void dropVals(csa* c, int* vals, int* refs);
+bool ownBlock(csa* c, block* b);
+bool ownSegment(csa* c, int s);
+bool segmentShared(csa* c, int s);
+bool ownAt(csa* c, int blk);
+bool ownAll(csa* c);
+bool shareVals(csa* c, int** refs);
+unsigned int offsetAt(csa* c, int blk);
+block* blockAt(csa* c, int blk, block* view);
+// Fewest full blocks worth gathering into a segment
+#define DENSE_MIN 4
+// How many blocks demote() takes out of a segment between shrinking it
+#define DEMOTE_STEP 4096
+
+int segmentAt(csa* c, int idx);
+void promote(csa* c, int blk);
+bool growSegment(csa* c, int s, int first, int blocks);
+bool appendToSegment(csa* c, int s, int blk);
+bool demote(csa* c, int s);
+bool splitSegment(csa* c, int s, int blk);
+int* segmentArray(segment* g);
+unsigned int blockOffset(int idx);
 int getBlockIndex(csa* c, int idx);
+// getBlockIndex() for csa_get/set/delete, counted in the probes total
+int lookupBlock(csa* c, int idx);
 bool getVal(block* b, int idx, int* val);
 int getValIndex(block* b, int idx);
-bool addNewBlock(csa* c, int idx, int val);
-bool addValToBlock(block* b, int idx, int val);
-int offsets(const void* b1, const void* b2);
+bool addNewBlock(csa* c, int blk, int idx, int val);
+bool resizeBlocks(csa* c, int cap);
+unsigned int valCapacity(csa_policy p, unsigned int cap, unsigned int need);
+bool addValToBlock(csa* c, block* b, int idx, int val);
+void shrinkVals(csa* c, block* b);
+int sortedIndex(const int* idx, int lo, int i);
+bool mergeSorted(csa* c, const int* idx, int lo, const int* val, int n);
+bool mergeIntoBlock(csa* c, block* b, mask_t msk, const int* slot);
+bool cellAt(block* b, int bit, int* idx, int* val);
+mask_t rangeBits(block* b, int lo, int hi, int* first);
+bool rangeExtreme(csa* c, int lo, int hi, int* out, bool biggest);
+bool wholeExtreme(csa* c, int* out, bool biggest);
+long long dotBlocks(const csaKernels* k, block* a, block* b);
+csa* combine(csa* a, csa* b, csaOp op);
+bool combineBlocks(csa* c, block* x, block* y, csaOp op);
+int combineVals(csaOp op, int x, int y);
 void printBlock(block* b, char* s);
@@ -1,17 +1,55 @@
 // Needs both the csa_foreach() and
 // the csa_delete() extensions
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <pthread.h>
 #include "csa.h"
 
 #define MAX 271
 
+// Batched mode : ./primes <max> [threads]
+// Each thread sieves its own run of blocks, WINDOW blocks at a time
+#define WINDOW      4096
+#define MAXTHREADS  64
+// Bigger than this, only a summary is printed
+#define PRINT_MAX   100000
+#define FILL_CHUNK  (1 << 22)
+// Keeps the chunk & block bounds, which run past max, inside an int
+#define LIMIT_MAX   (INT_MAX/2)
+
+// One thread's share of the batched sieve
+typedef struct {
+   csa* b;
+   const int* primes;
+   int nprimes;
+   int lo;
+   int hi;
+   long cleared;
+} sieveJob;
+
 void print(int* p, int* n);
 int next_factor(csa* b, int p);
+int batched(int max, int threads);
+double now(void);
+bool fill(csa* b, int max);
+int base_primes(int max, int** primes);
+void* sieve_range(void* arg);
+void check(csa* b, int max);
 
 // Compute prime numbers following method of:
 // https://en.wikipedia.org/wiki/Sieve_of_Eratosthenes
 // https://oeis.org/A000959
-int main(void)
+int main(int argc, char* argv[])
 {
+   if(argc > 1){
+      long max = strtol(argv[1], NULL, 10);
+      int threads = (argc > 2) ? atoi(argv[2]) : 1;
+      if(argc > 3 || max < 2 || max > LIMIT_MAX || threads < 1 || threads > MAXTHREADS){
+         fprintf(stderr, "Usage : %s [max [threads]]\n", argv[0]);
+         return EXIT_FAILURE;
+      }
+      return batched((int)max, threads);
+   }
    csa* b = csa_init();
    for(int i=2; i<=MAX; i++){
       assert(csa_set(b,i,i));
@@ -31,14 +69,8 @@ int main(void)
 
 int next_factor(csa* b, int p)
 {
-   p++;
-   int n;
-   for(int i=p; i<=MAX; i++){
-      if(csa_get(b,i,&n)){
-         return i;
-      }
-   }
-   return p;
+   int i;
+   return (csa_next(b, p+1, &i, NULL) && i<=MAX) ? i : p+1;
 }
 
 void print(int* p, int* n)
@@ -46,3 +78,154 @@ void print(int* p, int* n)
    *n = 0;
    printf("%d\n", *p);
 }
+
+double now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The same sieve, but clearing the multiples of every prime up to sqrt(max)
+// a window of blocks at a time with csa_delete_bits(), with the blocks split
+// into one run per thread. Prints the primes as above (or a summary, if there
+// are too many), and checks every one against a plain bit array.
+int batched(int max, int threads)
+{
+   csa* b = csa_init();
+   assert(b);
+   double t = now();
+   if(!fill(b, max)){
+      fprintf(stderr, "Out of memory filling to %d\n", max);
+      return EXIT_FAILURE;
+   }
+   double tfill = now() - t;
+   int* primes;
+   int nprimes = base_primes(max, &primes);
+
+   t = now();
+   assert(csa_delete_begin(b, 0, max+1));
+   int blocks = max/MSKLEN + 1;
+   sieveJob jobs[MAXTHREADS];
+   pthread_t th[MAXTHREADS];
+   for(int i=0; i<threads; i++){
+      int lo = (int)((long long)blocks * i / threads);
+      int hi = (int)((long long)blocks * (i+1) / threads);
+      jobs[i] = (sieveJob){.b = b, .primes = primes, .nprimes = nprimes, .lo = lo, .hi = hi};
+      assert(pthread_create(&th[i], NULL, sieve_range, &jobs[i])==0);
+   }
+   long cleared = 0;
+   for(int i=0; i<threads; i++){
+      assert(pthread_join(th[i], NULL)==0);
+      cleared += jobs[i].cleared;
+   }
+   csa_delete_end(b);
+   double tsieve = now() - t;
+
+   check(b, max);
+   int p = 0;
+   if(max <= PRINT_MAX){
+      csa_foreach(print, b, &p);
+   }
+   else{
+      csa_prev(b, max, &p, NULL);
+      printf("%d primes up to %d, the last %d\n", csa_range_count(b, 0, max+1), max, p);
+      printf("fill %.2f s, sieve %.2f s on %d thread%s : %ld deletes",
+             tfill, tsieve, threads, (threads==1) ? "" : "s", cleared);
+      if(cleared > 0){
+         printf(", %.2f ns each", tsieve * 1e9 / cleared);
+      }
+      printf("\n");
+   }
+   free(primes);
+   csa_free(&b);
+   return EXIT_SUCCESS;
+}
+
+// Sets b[i] = i for 2 <= i <= max, a chunk at a time
+bool fill(csa* b, int max)
+{
+   int chunk = (max/16 > FILL_CHUNK) ? max/16 : FILL_CHUNK;
+   int* vals = (int*)malloc(chunk * sizeof(int));
+   bool ok = (vals != NULL);
+   for(int lo=2; ok && lo<=max; lo+=chunk){
+      int n = (max - lo + 1 < chunk) ? max - lo + 1 : chunk;
+      for(int i=0; i<n; i++){
+         vals[i] = lo + i;
+      }
+      ok = csa_set_range(b, lo, vals, n);
+   }
+   free(vals);
+   return ok;
+}
+
+// The primes up to sqrt(max), from a small sieve of their own
+int base_primes(int max, int** primes)
+{
+   int root = 1;
+   while((long long)(root+1)*(root+1) <= max){
+      root++;
+   }
+   bool* composite = (bool*)calloc(root+1, sizeof(bool));
+   *primes = (int*)malloc((root+1) * sizeof(int));
+   assert(composite && *primes);
+   int n = 0;
+   for(int i=2; i<=root; i++){
+      if(!composite[i]){
+         (*primes)[n++] = i;
+         for(int j=i*i; j<=root; j+=i){
+            composite[j] = true;
+         }
+      }
+   }
+   free(composite);
+   return n;
+}
+
+// Clears, in blocks [lo, hi), every multiple of each base prime from its square up
+void* sieve_range(void* arg)
+{
+   sieveJob* job = (sieveJob*)arg;
+   mask_t bits[WINDOW];
+   for(int w=job->lo; w<job->hi; w+=WINDOW){
+      int n = (job->hi - w < WINDOW) ? job->hi - w : WINDOW;
+      long long first = (long long)w * MSKLEN, last = first + (long long)n * MSKLEN;
+      memset(bits, 0, n * sizeof(mask_t));
+      for(int k=0; k<job->nprimes; k++){
+         long long p = job->primes[k];
+         long long m = (p*p >= first) ? p*p : (first + p - 1) / p * p;
+         for(; m<last; m+=p){
+            bits[(m - first) / MSKLEN] |= 1ull << ((m - first) % MSKLEN);
+         }
+      }
+      job->cleared += csa_delete_bits(job->b, (int)first, bits, n);
+   }
+   return NULL;
+}
+
+// Every cell left is i = b[i], & prime, and none are missing
+void check(csa* b, int max)
+{
+   size_t words = (size_t)max/64 + 1;
+   uint64_t* composite = (uint64_t*)calloc(words, sizeof(uint64_t));
+   assert(composite);
+   for(long long i=2; i*i<=max; i++){
+      if(!(composite[i/64] & (1ull << (i%64)))){
+         for(long long j=i*i; j<=max; j+=i){
+            composite[j/64] |= 1ull << (j%64);
+         }
+      }
+   }
+   int count = 0, idx, val;
+   csa_iter it;
+   csa_iter_init(&it, b, 0, max+1);
+   while(csa_iter_next(&it, &idx, &val)){
+      assert(idx==val && idx >= 2 && !(composite[idx/64] & (1ull << (idx%64))));
+      count++;
+   }
+   for(int i=2; i<=max; i++){
+      count -= !(composite[i/64] & (1ull << (i%64)));
+   }
+   assert(count==0);
+   free(composite);
+}
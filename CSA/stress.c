@@ -0,0 +1,1145 @@
+// Randomised checks of the CSA against a plain dense array.
+// Needs the csa_delete() extension.
+#include "csa.h"
+#include "csa_types.h"
+#include "csa_pack.h"
+#include "csa_wide.h"
+#include "mydefs.h"
+
+// A user-defined element type
+struct point {
+   int x;
+   int y;
+};
+#define CSA_NAME csa_pt
+#define CSA_TYPE struct point
+#include "csa_gen.h"
+
+#define RANGE  (MSKLEN*300)
+#define ROUNDS 20
+#define OPS    20000
+#define CHECKS 1000
+#define UNSET  INT_MIN
+#define BATCH  3000
+#define PAGE   37
+#define QUERIES 300
+#define BIGSTR 100000
+#define ARENA_BYTES (1 << 24)
+#define SNAPS  4
+// Blocks in a segment long enough for csa_delete_begin() to shrink as it splits it
+#define LONG_RUN 9000
+
+uint64_t xorshift(uint64_t* s);
+void check_against(csa* c, int* ref);
+void random_order(uint64_t* seed, csa_policy p);
+void bulk(uint64_t* seed, csa_policy p);
+void check_export(csa* c, int* ref);
+int cmpint(const void* a, const void* b);
+void ranges(uint64_t* seed, csa_policy p);
+void check_range(csa* c, int* ref, int lo, int hi);
+void check_neighbours(csa* c, int* ref, int idx);
+void generic(uint64_t* seed);
+void kernels(uint64_t* seed, const char* name);
+void elementwise(uint64_t* seed);
+void check_combined(csa* c, int* ra, int* rb, int op);
+void mapped(uint64_t* seed, csa_policy p);
+void take(int* p, int* ac);
+void packed(uint64_t* seed);
+int pattern(uint64_t* seed, int kind, int i);
+void wide(uint64_t* seed, int width);
+void dense(uint64_t* seed, csa_policy p);
+void arena(uint64_t* seed, csa_policy p);
+void snapshots(uint64_t* seed, csa_policy p);
+void batch_delete(uint64_t* seed, csa_policy p);
+
+int main(void)
+{
+   uint64_t seed = 2463534242ull;
+   for(int r=0; r<ROUNDS; r++){
+      generic(&seed);
+      kernels(&seed, "scalar");
+      kernels(&seed, "sse4.1");
+      kernels(&seed, "avx2");
+      elementwise(&seed);
+      packed(&seed);
+      for(int w=64; w<=CSA_WIDE_MAX; w*=2){
+         wide(&seed, w);
+      }
+   }
+   assert(csa_simd_select(NULL));
+   for(csa_policy p=csa_compact; p<=csa_fast; p++){
+      for(int r=0; r<ROUNDS; r++){
+         random_order(&seed, p);
+         bulk(&seed, p);
+         ranges(&seed, p);
+         mapped(&seed, p);
+         dense(&seed, p);
+         arena(&seed, p);
+         snapshots(&seed, p);
+         batch_delete(&seed, p);
+      }
+   }
+   return EXIT_SUCCESS;
+}
+
+uint64_t xorshift(uint64_t* s)
+{
+   *s ^= *s << 13;
+   *s ^= *s >> 7;
+   *s ^= *s << 17;
+   return *s;
+}
+
+// Every cell agrees with the reference, and the blocks are
+// non-empty and strictly ordered by offset
+void check_against(csa* c, int* ref)
+{
+   int n;
+   for(int i=0; i<RANGE; i++){
+      if(ref[i]==UNSET){
+         assert(!csa_get(c, i, &n));
+      }
+      else{
+         assert(csa_get(c, i, &n));
+         assert(n==ref[i]);
+      }
+   }
+   assert(c->n <= c->cap);
+   for(int b=0; b<c->n; b++){
+      assert(c->b[b].msk);
+      assert(c->b[b].cap >= (unsigned int)__builtin_popcountl(c->b[b].msk));
+      assert(c->b[b].offset % MSKLEN == 0);
+      assert(b==0 || c->b[b-1].offset < c->b[b].offset);
+   }
+   struct csa_stats st;
+   int values = 0, filled = 0;
+   assert(csa_stats(c, &st));
+   for(int i=0; i<RANGE; i++){
+      values += (ref[i]!=UNSET);
+   }
+   for(int f=0; f<8; f++){
+      filled += st.fill[f];
+   }
+   assert(st.blocks==c->n && st.values==values && st.segments==c->ndense && filled==c->n);
+   assert(st.bytes >= sizeof(csa) + values*sizeof(int));
+   // Each segment covers full, back-to-back blocks, which point into it
+   for(int s=0, b=0; s<c->ndense; s++){
+      segment* g = &c->dense[s];
+      assert(g->blocks > 0);
+      assert(s==0 || c->dense[s-1].offset + c->dense[s-1].blocks*MSKLEN <= g->offset);
+      while(b<c->n && c->b[b].offset < g->offset){
+         b++;
+      }
+      for(int k=0; k<g->blocks; k++, b++){
+         assert(b<c->n && c->b[b].msk==~0ull);
+         assert(c->b[b].offset==g->offset + k*MSKLEN);
+         assert(c->b[b].vals==g->vals + k*MSKLEN);
+      }
+   }
+}
+
+// Sets & deletes in a random index order
+void random_order(uint64_t* seed, csa_policy p)
+{
+   static int ref[RANGE];
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   csa* c = csa_init_policy(p);
+   for(int op=0; op<OPS; op++){
+      int idx = (int)(xorshift(seed) % RANGE);
+      if(xorshift(seed) % 4){
+         int val = (int)(xorshift(seed) % 1000);
+         assert(csa_set(c, idx, val));
+         ref[idx] = val;
+      }
+      else{
+         assert(csa_delete(c, idx) == (ref[idx]!=UNSET));
+         ref[idx] = UNSET;
+      }
+      if(op%CHECKS==0){
+         check_against(c, ref);
+      }
+   }
+   check_against(c, ref);
+   csa_free(&c);
+}
+
+int cmpint(const void* a, const void* b)
+{
+   return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b);
+}
+
+// Paging through csa_export() gives every set cell, in order
+void check_export(csa* c, int* ref)
+{
+   int idx[PAGE], val[PAGE];
+   int from = 0, r = 0, got;
+   while((got = csa_export(c, from, idx, val, PAGE)) > 0){
+      for(int i=0; i<got; i++){
+         while(ref[r]==UNSET){
+            r++;
+         }
+         assert(idx[i]==r);
+         assert(val[i]==ref[r]);
+         r++;
+      }
+      from = idx[got-1] + 1;
+   }
+   while(r<RANGE){
+      assert(ref[r++]==UNSET);
+   }
+}
+
+// Sorted, unsorted & dense batches on top of existing contents
+void bulk(uint64_t* seed, csa_policy p)
+{
+   static int ref[RANGE];
+   static int idx[BATCH], val[BATCH];
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   csa* c = csa_init_policy(p);
+   assert(csa_set_many(c, idx, val, 0));
+   for(int i=0; i<BATCH/10; i++){
+      int j = (int)(xorshift(seed) % RANGE);
+      assert(csa_set(c, j, i));
+      ref[j] = i;
+   }
+
+   // Sorted, with duplicates - the later one wins
+   for(int i=0; i<BATCH; i++){
+      idx[i] = (int)(xorshift(seed) % RANGE);
+   }
+   qsort(idx, BATCH, sizeof(int), cmpint);
+   for(int i=0; i<BATCH; i++){
+      val[i] = (int)(xorshift(seed) % 1000);
+      ref[idx[i]] = val[i];
+   }
+   assert(csa_set_many(c, idx, val, BATCH));
+   check_against(c, ref);
+
+   // Unsorted
+   for(int i=0; i<BATCH; i++){
+      idx[i] = (int)(xorshift(seed) % RANGE);
+      val[i] = -i;
+      ref[idx[i]] = val[i];
+   }
+   assert(csa_set_many(c, idx, val, BATCH));
+   check_against(c, ref);
+
+   // Dense, starting part way through a block
+   int lo = (int)(xorshift(seed) % (RANGE - BATCH));
+   for(int i=0; i<BATCH; i++){
+      val[i] = i * 3;
+      ref[lo + i] = val[i];
+   }
+   assert(csa_set_range(c, lo, val, BATCH));
+   check_against(c, ref);
+   check_export(c, ref);
+
+   idx[0] = -1;
+   assert(!csa_set_many(c, idx, val, 1));
+   assert(!csa_set_range(c, -1, val, 1));
+   csa_free(&c);
+}
+
+// Iterator & aggregates over [lo, hi) agree with a walk of the reference
+void check_range(csa* c, int* ref, int lo, int hi)
+{
+   csa_iter it;
+   int idx, val, count = 0, mn = INT_MAX, mx = INT_MIN, got;
+   long long sum = 0;
+   csa_iter_init(&it, c, lo, hi);
+   for(int i=(lo<0 ? 0 : lo); i<hi && i<RANGE; i++){
+      if(ref[i]!=UNSET){
+         assert(csa_iter_next(&it, &idx, &val));
+         assert(idx==i && val==ref[i]);
+         count++;
+         sum += ref[i];
+         mn = (ref[i] < mn) ? ref[i] : mn;
+         mx = (ref[i] > mx) ? ref[i] : mx;
+      }
+   }
+   assert(!csa_iter_next(&it, &idx, &val));
+   assert(!csa_iter_next(&it, &idx, &val));
+   assert(csa_range_count(c, lo, hi)==count);
+   assert(csa_range_sum(c, lo, hi)==sum);
+   assert(csa_range_min(c, lo, hi, &got)==(count>0));
+   assert(count==0 || got==mn);
+   assert(csa_range_max(c, lo, hi, &got)==(count>0));
+   assert(count==0 || got==mx);
+}
+
+// Random ranges, including empty, reversed & out-of-bounds ones
+void ranges(uint64_t* seed, csa_policy p)
+{
+   static int ref[RANGE];
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   csa* c = csa_init_policy(p);
+   check_range(c, ref, 0, RANGE);
+   check_neighbours(c, ref, 0);
+   for(int i=0; i<RANGE/8; i++){
+      // Clumps, so there are full, partial & missing blocks
+      int j = (int)(xorshift(seed) % RANGE);
+      j -= (j % (MSKLEN*3) < MSKLEN) ? 0 : j % MSKLEN;
+      ref[j] = (int)(xorshift(seed) % 2001) - 1000;
+      assert(csa_set(c, j, ref[j]));
+   }
+   check_range(c, ref, 0, RANGE);
+   check_range(c, ref, -MSKLEN, RANGE+MSKLEN);
+   check_range(c, ref, RANGE, 0);
+   for(int q=0; q<QUERIES; q++){
+      int lo = (int)(xorshift(seed) % RANGE);
+      int hi = lo + (int)(xorshift(seed) % (MSKLEN*4));
+      check_range(c, ref, lo, hi);
+      check_neighbours(c, ref, lo);
+   }
+   check_neighbours(c, ref, -1);
+   check_neighbours(c, ref, RANGE);
+   csa_free(&c);
+}
+
+// csa_next() & csa_prev() find the nearest set cells either side of idx
+void check_neighbours(csa* c, int* ref, int idx)
+{
+   int nxt = (idx < 0) ? 0 : idx, prv = (idx >= RANGE) ? RANGE-1 : idx;
+   int i, v;
+   while(nxt<RANGE && ref[nxt]==UNSET){
+      nxt++;
+   }
+   while(prv>=0 && ref[prv]==UNSET){
+      prv--;
+   }
+   assert(csa_next(c, idx, &i, &v)==(nxt<RANGE));
+   assert(nxt==RANGE || (i==nxt && v==ref[nxt]));
+   assert(csa_prev(c, idx, &i, &v)==(prv>=0));
+   assert(prv<0 || (i==prv && v==ref[prv]));
+}
+
+// The same random sets & deletes on 64-bit, double & struct CSAs
+void generic(uint64_t* seed)
+{
+   static int ref[RANGE];
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   csa_i64* ci = csa_i64_init();
+   csa_f64* cf = csa_f64_init();
+   csa_pt* cp = csa_pt_init();
+   for(int op=0; op<OPS; op++){
+      int idx = (int)(xorshift(seed) % RANGE);
+      if(xorshift(seed) % 4){
+         int val = (int)(xorshift(seed) % 1000);
+         assert(csa_i64_set(ci, idx, (int64_t)val << 40));
+         assert(csa_f64_set(cf, idx, val * 0.25));
+         assert(csa_pt_set(cp, idx, (struct point){val, -val}));
+         ref[idx] = val;
+      }
+      else{
+         bool was = (ref[idx]!=UNSET);
+         assert(csa_i64_delete(ci, idx)==was);
+         assert(csa_f64_delete(cf, idx)==was);
+         assert(csa_pt_delete(cp, idx)==was);
+         ref[idx] = UNSET;
+      }
+   }
+
+   int count = 0, nxt = -1, got;
+   for(int i=0; i<RANGE; i++){
+      int64_t vi = 0;
+      double vf = 0.0, want;
+      struct point vp = {0, 0};
+      bool set = (ref[i]!=UNSET);
+      assert(csa_i64_get(ci, i, &vi)==set);
+      assert(csa_f64_get(cf, i, &vf)==set);
+      assert(csa_pt_get(cp, i, &vp)==set);
+      if(set){
+         want = ref[i] * 0.25;
+         assert(vi==(int64_t)ref[i] << 40);
+         assert(memcmp(&vf, &want, sizeof(double))==0);
+         assert(vp.x==ref[i] && vp.y==-ref[i]);
+         assert(csa_i64_next(ci, nxt+1, &got, NULL) && got==i);
+         nxt = i;
+         count++;
+      }
+   }
+   assert(!csa_i64_next(ci, nxt+1, &got, NULL));
+   assert(csa_i64_count(ci)==count && csa_f64_count(cf)==count && csa_pt_count(cp)==count);
+   csa_i64_free(&ci);
+   csa_f64_free(&cf);
+   csa_pt_free(&cp);
+   assert(!ci && !cf && !cp);
+}
+
+// Reductions, updates & dot products with one set of kernels (skipped if the CPU lacks them)
+void kernels(uint64_t* seed, const char* name)
+{
+   static int ref[RANGE], ref2[RANGE];
+   if(!csa_simd_select(name)){
+      return;
+   }
+   assert(strcmp(csa_simd_name(), name)==0);
+   csa* a = csa_init();
+   csa* b = csa_init();
+   int got;
+   assert(csa_sum(a)==0 && !csa_min(a, &got) && !csa_max(a, &got) && csa_dot(a, b)==0);
+   for(int i=0; i<RANGE; i++){
+      // Dense & sparse stretches. a spans the whole int range, b is kept
+      // small enough that the dot product can't overflow
+      bool dense = (i / (MSKLEN*4)) % 2;
+      ref[i] = (dense || xorshift(seed) % 8 == 0) ? (int)xorshift(seed) : UNSET;
+      ref2[i] = (dense || xorshift(seed) % 8 == 0) ? (int)(xorshift(seed) % 2048) - 1024 : UNSET;
+      if(ref[i]!=UNSET){
+         assert(csa_set(a, i, ref[i]));
+      }
+      if(ref2[i]!=UNSET){
+         assert(csa_set(b, i, ref2[i]));
+      }
+   }
+
+   long long sum = 0, dot = 0;
+   int mn = INT_MAX, mx = INT_MIN;
+   for(int i=0; i<RANGE; i++){
+      if(ref[i]!=UNSET){
+         sum += ref[i];
+         mn = (ref[i] < mn) ? ref[i] : mn;
+         mx = (ref[i] > mx) ? ref[i] : mx;
+         if(ref2[i]!=UNSET){
+            dot += (long long)ref[i] * ref2[i];
+         }
+      }
+   }
+   assert(csa_sum(a)==sum);
+   assert(csa_range_sum(a, 0, RANGE)==sum);
+   assert(csa_min(a, &got) && got==mn);
+   assert(csa_max(a, &got) && got==mx);
+   assert(csa_dot(a, b)==dot && csa_dot(b, a)==dot);
+
+   int k = (int)(xorshift(seed) % 1000) - 500;
+   csa_scale(a, k);
+   csa_add_scalar(a, k);
+   for(int i=0; i<RANGE; i++){
+      if(ref[i]!=UNSET){
+         ref[i] = (int)((unsigned int)ref[i] * (unsigned int)k + (unsigned int)k);
+      }
+   }
+   check_against(a, ref);
+   csa_free(&a);
+   csa_free(&b);
+
+   // Unpacking every width, with & without a ragged end, against the bits one at a time
+   static unsigned char bits[MSKLEN*4 + 8];
+   int out[MSKLEN];
+   for(size_t i=0; i<sizeof(bits); i++){
+      bits[i] = (unsigned char)xorshift(seed);
+   }
+   for(int width=0; width<=32; width++){
+      for(int n=MSKLEN-9; n<=MSKLEN; n++){
+         int base = (int)xorshift(seed);
+         simdKernels()->unpack(bits, n, width, base, out);
+         for(int i=0; i<n; i++){
+            uint32_t v = 0;
+            for(int j=0; j<width; j++){
+               int bit = i*width + j;
+               v |= (uint32_t)((bits[bit/8] >> (bit%8)) & 1) << j;
+            }
+            assert(out[i]==(int)((uint32_t)base + v));
+         }
+      }
+   }
+}
+
+// op : 0 add, 1 mul, 2 union, 3 intersect
+void check_combined(csa* c, int* ra, int* rb, int op)
+{
+   static int want[RANGE];
+   for(int i=0; i<RANGE; i++){
+      bool ina = (ra[i]!=UNSET), inb = (rb[i]!=UNSET);
+      want[i] = UNSET;
+      if(ina && inb){
+         want[i] = (op==0) ? (int)((unsigned int)ra[i] + (unsigned int)rb[i]) :
+                   (op==1) ? (int)((unsigned int)ra[i] * (unsigned int)rb[i]) : ra[i];
+      }
+      else if((op==0 || op==2) && (ina || inb)){
+         want[i] = ina ? ra[i] : rb[i];
+      }
+   }
+   check_against(c, want);
+}
+
+// add, mul, union & intersect of overlapping random arrays
+void elementwise(uint64_t* seed)
+{
+   static int ra[RANGE], rb[RANGE], none[RANGE];
+   csa* (*ops[])(csa*, csa*) = {csa_add, csa_mul, csa_union, csa_intersect};
+   csa* a = csa_init();
+   csa* b = csa_init();
+   csa* e = csa_init();
+   for(int i=0; i<RANGE; i++){
+      // Some stretches only in a, only in b, in both, or in neither
+      int region = (i / (MSKLEN*2)) % 4;
+      none[i] = UNSET;
+      ra[i] = ((region & 1) && xorshift(seed) % 3) ? (int)xorshift(seed) : UNSET;
+      rb[i] = ((region & 2) && xorshift(seed) % 3) ? (int)xorshift(seed) : UNSET;
+      if(ra[i]!=UNSET){
+         assert(csa_set(a, i, ra[i]));
+      }
+      if(rb[i]!=UNSET){
+         assert(csa_set(b, i, rb[i]));
+      }
+   }
+   for(int op=0; op<4; op++){
+      csa* c = ops[op](a, b);
+      check_combined(c, ra, rb, op);
+      csa_free(&c);
+      c = ops[op](a, e);
+      check_combined(c, ra, none, op);
+      csa_free(&c);
+      c = ops[op](e, b);
+      check_combined(c, none, rb, op);
+      csa_free(&c);
+      c = ops[op](a, a);
+      check_combined(c, ra, ra, op);
+      csa_free(&c);
+      assert(ops[op](a, NULL)==NULL);
+   }
+   check_against(a, ra);
+   check_against(b, rb);
+   csa_free(&a);
+   csa_free(&b);
+   csa_free(&e);
+}
+
+// Adds up the values, then scribbles on them
+void take(int* p, int* ac)
+{
+   *ac += *p;
+   *p = 0;
+}
+
+// A saved & re-mapped CSA answers every query as the original does, & can't be changed
+void mapped(uint64_t* seed, csa_policy p)
+{
+   static int ref[RANGE];
+   static char s1[BIGSTR], s2[BIGSTR];
+   const char* path = "stress.csa";
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   csa* c = csa_init_policy(p);
+   assert(csa_save(c, path));
+   csa* m = csa_open_mmap(path);
+   assert(m && m->n==0);
+   check_range(m, ref, 0, RANGE);
+   csa_free(&m);
+   for(int i=0; i<RANGE/8; i++){
+      int j = (int)(xorshift(seed) % RANGE);
+      j -= (j % (MSKLEN*3) < MSKLEN) ? 0 : j % MSKLEN;
+      ref[j] = (int)(xorshift(seed) % 2001) - 1000;
+      assert(csa_set(c, j, ref[j]));
+   }
+   assert(csa_save(c, path));
+   m = csa_open_mmap(path);
+   assert(m && m->n==c->n);
+
+   int n, sa = 0, sb = 0;
+   for(int i=0; i<RANGE; i++){
+      assert(csa_get(m, i, &n)==(ref[i]!=UNSET));
+      assert(ref[i]==UNSET || n==ref[i]);
+   }
+   check_export(m, ref);
+   for(int q=0; q<QUERIES; q++){
+      int lo = (int)(xorshift(seed) % RANGE);
+      int hi = lo + (int)(xorshift(seed) % (MSKLEN*4));
+      check_range(m, ref, lo, hi);
+      check_neighbours(m, ref, lo);
+   }
+   check_range(m, ref, -MSKLEN, RANGE+MSKLEN);
+   s1[0] = s2[0] = '\0';
+   csa_tostring(c, s1);
+   csa_tostring(m, s2);
+   assert(strcmp(s1, s2)==0);
+   int a, b;
+   assert(csa_sum(m)==csa_sum(c));
+   assert(csa_min(m, &a) && csa_min(c, &b) && a==b);
+   assert(csa_max(m, &a) && csa_max(c, &b) && a==b);
+   assert(csa_dot(m, c)==csa_dot(c, c));
+   csa* x = csa_add(m, m);
+   csa* y = csa_add(c, c);
+   s1[0] = s2[0] = '\0';
+   csa_tostring(x, s1);
+   csa_tostring(y, s2);
+   assert(strcmp(s1, s2)==0);
+   csa_free(&x);
+   csa_free(&y);
+
+   // Read-only : nothing gets through, & foreach only sees copies
+   int j = (int)(xorshift(seed) % RANGE), idx[1] = {j}, val[1] = {1};
+   assert(!csa_set(m, j, 1));
+   assert(!csa_delete(m, j));
+   assert(!csa_set_many(m, idx, val, 1));
+   assert(!csa_set_range(m, j, val, 1));
+   csa_scale(m, 3);
+   csa_add_scalar(m, 3);
+   csa_foreach(take, m, &sa);
+   csa_foreach(take, c, &sb);
+   assert(sa==sb);
+   for(int i=0; i<RANGE; i++){
+      assert(csa_get(m, i, &n)==(ref[i]!=UNSET));
+      assert(ref[i]==UNSET || n==ref[i]);
+   }
+   csa_free(&m);
+   assert(!m);
+   csa_free(&c);
+
+   // A directory out of order, off a block boundary, with an empty block, or not
+   // adding up to the values
+   c = csa_init();
+   for(int i=0; i<3; i++){
+      assert(csa_set(c, i*MSKLEN*2 + i, i));
+   }
+   // Each replaces directory entry where[k]
+   int where[4] = {0, 1, 2, 2};
+   csaFileBlock bad[4] = {
+      {.msk = 1, .offset = MSKLEN*2, .start = 0},
+      {.msk = 2, .offset = MSKLEN*2 + 1, .start = 1},
+      {.msk = 4, .offset = 0, .start = 2},
+      {.msk = 3, .offset = MSKLEN*4, .start = 2}
+   };
+   for(int k=0; k<4; k++){
+      assert(csa_save(c, path));
+      FILE* f = fopen(path, "r+b");
+      long at = (long)sizeof(csaFileHeader) + where[k] * (long)sizeof(csaFileBlock);
+      assert(f && fseek(f, at, SEEK_SET)==0 && fwrite(&bad[k], sizeof(bad[k]), 1, f)==1 && fclose(f)==0);
+      assert(!csa_open_mmap(path));
+   }
+   // An empty block, with the next one taking up its value so the totals still add up
+   csaFileBlock empty[2] = {
+      {.msk = 0, .offset = MSKLEN*2, .start = 1},
+      {.msk = 3, .offset = MSKLEN*4, .start = 1}
+   };
+   assert(csa_save(c, path));
+   FILE* f = fopen(path, "r+b");
+   assert(f && fseek(f, (long)sizeof(csaFileHeader) + (long)sizeof(csaFileBlock), SEEK_SET)==0);
+   assert(fwrite(empty, sizeof(empty), 1, f)==1 && fclose(f)==0);
+   assert(!csa_open_mmap(path));
+   assert(csa_save(c, path));
+   m = csa_open_mmap(path);
+   assert(m && m->n==3);
+   csa_free(&m);
+   csa_free(&c);
+
+   // Not a CSA file, or cut short
+   f = fopen(path, "r+b");
+   assert(f && fwrite("NOTACSA!", 1, 8, f)==8 && fclose(f)==0);
+   assert(!csa_open_mmap(path));
+   f = fopen(path, "wb");
+   assert(f && fclose(f)==0);
+   assert(!csa_open_mmap(path));
+   assert(remove(path)==0);
+   assert(!csa_open_mmap(path));
+}
+
+// Values of each kind the packed encodings care about
+int pattern(uint64_t* seed, int kind, int i)
+{
+   switch(kind){
+      // Small
+      case 0: return (int)(xorshift(seed) % 16);
+      // Growing steadily, with jitter
+      case 1: return i*7 + (int)(xorshift(seed) % 3);
+      // Shrinking
+      case 2: return -i*1000;
+      // Anything at all, extremes included (INT_MIN is UNSET)
+      case 3: return (xorshift(seed) % 8) ? (int)xorshift(seed) : ((xorshift(seed) % 2) ? INT_MAX : INT_MIN+1);
+      // All the same
+      default: return 42;
+   }
+}
+
+// Every encoding gives back exactly what went in
+void packed(uint64_t* seed)
+{
+   static int ref[RANGE];
+   static char s1[BIGSTR], s2[BIGSTR];
+   for(int kind=0; kind<5; kind++){
+      for(int i=0; i<RANGE; i++){
+         ref[i] = UNSET;
+      }
+      csa* c = csa_init();
+      int count = 0;
+      for(int i=0; i<RANGE/8; i++){
+         int j = (int)(xorshift(seed) % RANGE);
+         j -= (j % (MSKLEN*3) < MSKLEN) ? 0 : j % MSKLEN;
+         count += (ref[j]==UNSET);
+         ref[j] = 0;
+      }
+      // Values follow the index order, so "growing" really grows
+      for(int i=0; i<RANGE; i++){
+         if(ref[i]!=UNSET){
+            ref[i] = pattern(seed, kind, i);
+            assert(csa_set(c, i, ref[i]));
+         }
+      }
+      size_t bytes[csa_enc_delta+1];
+      for(csa_encoding e=csa_enc_auto; e<=csa_enc_delta; e++){
+         csa_packed* p = csa_pack(c, e);
+         assert(p);
+         int n;
+         for(int i=0; i<RANGE; i++){
+            assert(csa_packed_get(p, i, &n)==(ref[i]!=UNSET));
+            assert(ref[i]==UNSET || n==ref[i]);
+         }
+         assert(!csa_packed_get(p, -1, &n));
+         assert(csa_packed_count(p)==count);
+         assert(csa_packed_sum(p)==csa_sum(c));
+         csa* u = csa_unpack(p);
+         s1[0] = s2[0] = '\0';
+         csa_tostring(c, s1);
+         csa_tostring(u, s2);
+         assert(strcmp(s1, s2)==0);
+         csa_free(&u);
+         bytes[e] = csa_packed_bytes(p);
+         csa_packed_free(&p);
+         assert(!p);
+      }
+      // Auto picks the smallest for each block, so never loses overall
+      for(csa_encoding e=csa_enc_raw; e<=csa_enc_delta; e++){
+         assert(bytes[csa_enc_auto] <= bytes[e]);
+      }
+      assert(kind==3 || bytes[csa_enc_auto] < bytes[csa_enc_raw]);
+      csa_free(&c);
+   }
+   assert(!csa_pack(NULL, csa_enc_auto));
+}
+
+// Wide blocks agree with a dense array through sets & deletes, and copy a CSA exactly
+void wide(uint64_t* seed, int width)
+{
+   static int ref[RANGE];
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   assert(!csa_wide_init(width+1));
+   csa_wide* w = csa_wide_init(width);
+   csa* c = csa_init();
+   int n, count = 0;
+   for(int op=0; op<OPS; op++){
+      // Mostly in a few dense stretches, so blocks fill, empty & come back
+      int idx = (int)(xorshift(seed) % RANGE);
+      idx = (xorshift(seed) % 4) ? idx % (CSA_WIDE_MAX*3) : idx;
+      if(xorshift(seed) % 3){
+         int val = (int)(xorshift(seed) % 1000);
+         assert(csa_wide_set(w, idx, val));
+         assert(csa_set(c, idx, val));
+         count += (ref[idx]==UNSET);
+         ref[idx] = val;
+      }
+      else{
+         assert(csa_wide_delete(w, idx)==(ref[idx]!=UNSET));
+         assert(csa_delete(c, idx)==(ref[idx]!=UNSET));
+         count -= (ref[idx]!=UNSET);
+         ref[idx] = UNSET;
+      }
+   }
+   for(int i=0; i<RANGE; i++){
+      assert(csa_wide_get(w, i, &n)==(ref[i]!=UNSET));
+      assert(ref[i]==UNSET || n==ref[i]);
+   }
+   assert(csa_wide_count(w)==count);
+   for(int b=0; b<w->n; b++){
+      assert(w->b[b].offset % width==0);
+      assert(b==0 || w->b[b-1].offset < w->b[b].offset);
+   }
+   assert(!csa_wide_get(w, -1, &n));
+   assert(!csa_wide_delete(w, -1));
+
+   csa_wide* copy = csa_wide_from(c, 0);
+   assert(copy && csa_wide_count(copy)==count);
+   for(int i=0; i<RANGE; i++){
+      assert(csa_wide_get(copy, i, &n)==(ref[i]!=UNSET));
+      assert(ref[i]==UNSET || n==ref[i]);
+   }
+   csa_wide_free(&copy);
+   for(int i=0; i<RANGE; i++){
+      if(ref[i]!=UNSET){
+         assert(csa_wide_delete(w, i));
+      }
+   }
+   assert(w->n==0 && csa_wide_count(w)==0);
+   csa_wide_free(&w);
+   assert(!w);
+   csa_free(&c);
+}
+
+// Full stretches turn into segments & back as they fill, get holes & refill
+void dense(uint64_t* seed, csa_policy p)
+{
+   static int ref[RANGE];
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   csa* c = csa_init_policy(p);
+   // Block by block, growing one segment a block at a time
+   for(int i=0; i<RANGE/2; i++){
+      ref[i] = i;
+      assert(csa_set(c, i, i));
+      if(i%(MSKLEN*16)==0){
+         check_against(c, ref);
+      }
+   }
+   check_against(c, ref);
+   assert(c->ndense==1 && c->dense[0].blocks==RANGE/2/MSKLEN);
+   // A hole in the middle takes just its block out, leaving segments either side, & filling it
+   // joins it back onto the one before
+   for(int t=0; t<4; t++){
+      assert(csa_delete(c, RANGE/4));
+      ref[RANGE/4] = UNSET;
+      check_against(c, ref);
+      assert(c->ndense==2 && c->dense[0].blocks + c->dense[1].blocks==RANGE/2/MSKLEN - 1);
+      ref[RANGE/4] = RANGE/4;
+      assert(csa_set(c, RANGE/4, RANGE/4));
+      check_against(c, ref);
+      assert(c->ndense==2 && c->dense[0].blocks + c->dense[1].blocks==RANGE/2/MSKLEN);
+   }
+   // In one go, next to the first lot
+   int* vals = (int*)malloc(RANGE/4 * sizeof(int));
+   assert(vals);
+   for(int i=0; i<RANGE/4; i++){
+      vals[i] = ref[RANGE/2 + i] = -i;
+   }
+   assert(csa_set_range(c, RANGE/2, vals, RANGE/4));
+   check_against(c, ref);
+   check_range(c, ref, 0, RANGE);
+   free(vals);
+   // Holes & refills all over
+   for(int op=0; op<OPS/4; op++){
+      int idx = (int)(xorshift(seed) % RANGE);
+      if(xorshift(seed) % 2){
+         assert(csa_delete(c, idx)==(ref[idx]!=UNSET));
+         ref[idx] = UNSET;
+      }
+      else{
+         ref[idx] = idx;
+         assert(csa_set(c, idx, idx));
+      }
+      if(op%CHECKS==0){
+         check_against(c, ref);
+      }
+   }
+   check_against(c, ref);
+   // Fill everything back in, so it all ends up in segments again
+   for(int i=0; i<RANGE; i++){
+      if(ref[i]==UNSET){
+         ref[i] = i;
+         assert(csa_set(c, i, i));
+      }
+   }
+   check_against(c, ref);
+   for(int s=0; s<c->ndense; s++){
+      assert(c->dense[s].blocks >= 4);
+   }
+   static char str[BIGSTR];
+   csa_tostring(c, str);
+   assert(strncmp(str, "300 blocks {64|[0]=0:[1]=1:", 27)==0);
+   csa_free(&c);
+}
+
+// A CSA in an arena acts like any other, until the arena runs out
+void arena(uint64_t* seed, csa_policy p)
+{
+   static unsigned char buf[ARENA_BYTES];
+   static int ref[RANGE], before[RANGE];
+   static char s1[BIGSTR], s2[BIGSTR];
+   const char* path = "arena.csa";
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   csa_arena a;
+   csa_arena_init(&a, buf, sizeof(buf));
+   csa* c = csa_init_arena(&a);
+   assert(c && c->arena==&a);
+   c->policy = p;
+   for(int op=0; op<OPS; op++){
+      int idx = (int)(xorshift(seed) % RANGE);
+      if(xorshift(seed) % 4){
+         ref[idx] = (int)(xorshift(seed) % 1000);
+         assert(csa_set(c, idx, ref[idx]));
+      }
+      else{
+         assert(csa_delete(c, idx)==(ref[idx]!=UNSET));
+         ref[idx] = UNSET;
+      }
+      if(op%CHECKS==0){
+         check_against(c, ref);
+      }
+   }
+   // So does a snapshot of it
+   csa* v = csa_snapshot(c);
+   assert(v && v->arena==&a);
+   memcpy(before, ref, sizeof(ref));
+   // Full blocks get their segment from the arena too, and give it up on a delete
+   for(int i=0; i<RANGE/4; i++){
+      ref[i] = i;
+      assert(csa_set(c, i, i));
+   }
+   check_against(c, ref);
+   assert(c->ndense > 0);
+   assert(csa_delete(c, RANGE/8));
+   ref[RANGE/8] = UNSET;
+   check_against(c, ref);
+
+   // Packing, saving & combining read it like any other, and make heap CSAs
+   int n;
+   csa_packed* k = csa_pack(c, csa_enc_auto);
+   assert(k && csa_packed_count(k)==csa_range_count(c, 0, RANGE));
+   for(int i=0; i<RANGE; i++){
+      assert(csa_packed_get(k, i, &n)==(ref[i]!=UNSET));
+      assert(ref[i]==UNSET || n==ref[i]);
+   }
+   csa* u = csa_unpack(k);
+   assert(u && !u->arena);
+   check_against(u, ref);
+   assert(csa_save(c, path));
+   csa* m = csa_open_mmap(path);
+   assert(m && !csa_snapshot(m));
+   check_against(v, before);
+   csa_free(&v);
+   s1[0] = s2[0] = '\0';
+   csa_tostring(c, s1);
+   csa_tostring(m, s2);
+   assert(strcmp(s1, s2)==0);
+   csa* d = csa_init_arena(&a);
+   assert(d && csa_set(d, 0, 5) && csa_set(d, RANGE-1, 7));
+   csa* x = csa_add(c, d);
+   assert(x && !x->arena && csa_sum(x)==csa_sum(c) + 12);
+   csa_free(&x);
+   csa_free(&m);
+   csa_free(&u);
+   csa_packed_free(&k);
+   assert(remove(path)==0);
+
+   // Freeing hands nothing back - resetting hands back everything
+   size_t used = a.used;
+   csa_free(&c);
+   csa_free(&d);
+   assert(!c && !d && a.used==used);
+   csa_arena_reset(&a);
+   assert(a.used==0);
+
+   // Sets fail once it's full, keeping what's there
+   csa_arena_init(&a, buf, 1024);
+   c = csa_init_arena(&a);
+   assert(c);
+   c->policy = p;
+   int full = 0;
+   while(csa_set(c, full*MSKLEN, full)){
+      full++;
+   }
+   assert(full > 0 && c->n==full);
+   for(int i=0; i<full; i++){
+      assert(csa_get(c, i*MSKLEN, &n) && n==i);
+   }
+   csa_free(&c);
+   csa_arena_init(&a, buf, sizeof(csa) / 2);
+   assert(!csa_init_arena(&a));
+   csa_arena_init(&a, NULL, 0);
+   assert(!csa_init_arena(&a));
+   assert(!csa_init_arena(NULL));
+}
+
+// Snapshots keep what they were taken with, whatever happens to the CSA afterwards
+void snapshots(uint64_t* seed, csa_policy p)
+{
+   static int ref[RANGE], old[SNAPS][RANGE];
+   int vals[MSKLEN];
+   struct csa_stats st;
+   csa* snap[SNAPS];
+   for(int i=0; i<RANGE; i++){
+      ref[i] = UNSET;
+   }
+   csa* c = csa_init_policy(p);
+   // Dense to begin with, so there are segments to share too
+   for(int i=0; i<RANGE/4; i++){
+      ref[i] = i;
+      assert(csa_set(c, i, i));
+   }
+   assert(csa_stats(c, &st) && st.shared==0);
+   // Writing inside a shared segment copies just that block, & the rest of c still reads the
+   // snapshot's array
+   csa* v = csa_snapshot(c);
+   int blk = RANGE/8/MSKLEN;
+   assert(v && csa_set(c, RANGE/8, -1));
+   ref[RANGE/8] = -1;
+   assert(c->ndense==2 && c->dense[0].vals==v->dense[0].vals && c->dense[1].vals==v->b[blk+1].vals);
+   assert(c->b[blk].vals!=v->b[blk].vals && v->b[blk].vals[RANGE/8 % MSKLEN]==RANGE/8);
+   csa_free(&v);
+   check_against(c, ref);
+   for(int k=0; k<SNAPS; k++){
+      snap[k] = csa_snapshot(c);
+      assert(snap[k] && snap[k]->frozen);
+      memcpy(old[k], ref, sizeof(ref));
+      assert(csa_stats(c, &st) && st.shared > 0);
+      for(int op=0; op<OPS/SNAPS; op++){
+         int idx = (int)(xorshift(seed) % RANGE);
+         switch(xorshift(seed) % 8){
+            case 0:
+               assert(csa_delete(c, idx)==(ref[idx]!=UNSET));
+               ref[idx] = UNSET;
+               break;
+            case 1:
+               // A block's worth in one go
+               idx -= idx % MSKLEN;
+               for(int i=0; i<MSKLEN; i++){
+                  vals[i] = ref[idx+i] = -i;
+               }
+               assert(csa_set_range(c, idx, vals, MSKLEN));
+               break;
+            default:
+               ref[idx] = (int)(xorshift(seed) % 1000);
+               assert(csa_set(c, idx, ref[idx]));
+         }
+      }
+      check_against(c, ref);
+   }
+   csa_scale(c, 3);
+   csa_add_scalar(c, 1);
+   int sum = 0, want = 0;
+   csa_foreach(take, c, &sum);
+   for(int i=0; i<RANGE; i++){
+      want += (ref[i]==UNSET) ? 0 : ref[i]*3 + 1;
+      ref[i] = (ref[i]==UNSET) ? UNSET : 0;
+   }
+   assert(sum==want);
+   check_against(c, ref);
+   for(int k=0; k<SNAPS; k++){
+      check_against(snap[k], old[k]);
+   }
+
+   // Read-only, like a mapped file
+   int n = 0;
+   assert(!csa_set(snap[0], 0, 1));
+   assert(!csa_delete(snap[0], 0));
+   assert(!csa_set_range(snap[0], 0, vals, 1));
+   csa_scale(snap[0], 2);
+   csa_foreach(take, snap[0], &n);
+   check_against(snap[0], old[0]);
+
+   // Taken of a snapshot, & outliving everything it shares with
+   csa* again = csa_snapshot(snap[0]);
+   assert(again);
+   for(int k=1; k<SNAPS; k+=2){
+      csa_free(&snap[k]);
+   }
+   csa_free(&c);
+   for(int k=0; k<SNAPS; k+=2){
+      csa_free(&snap[k]);
+   }
+   check_against(again, old[0]);
+   assert(csa_stats(again, &st) && st.shared==0);
+   csa_free(&again);
+   assert(!csa_snapshot(NULL));
+}
+
+// Deleting masks of cells between csa_delete_begin() & csa_delete_end()
+void batch_delete(uint64_t* seed, csa_policy p)
+{
+   static int ref[RANGE], old[RANGE];
+   static mask_t bits[RANGE/MSKLEN];
+   csa* c = csa_init_policy(p);
+   // Dense at the start, so segments get split, & scattered after
+   for(int i=0; i<RANGE; i++){
+      ref[i] = (i < RANGE/3 || xorshift(seed) % 3==0) ? i : UNSET;
+      if(ref[i]!=UNSET){
+         assert(csa_set(c, i, i));
+      }
+   }
+   csa* snap = csa_snapshot(c);
+   assert(snap && !csa_delete_begin(snap, 0, RANGE));
+   memcpy(old, ref, sizeof(ref));
+   int lo = (int)(xorshift(seed) % (RANGE/MSKLEN)) * MSKLEN;
+   int hi = lo + (int)(xorshift(seed) % (RANGE - lo));
+   assert(csa_delete_begin(c, lo, hi));
+   long want = 0, got = 0;
+   int blocks = (hi - lo) / MSKLEN;
+   for(int k=0; k<blocks; k++){
+      // Now & then a whole block goes
+      bits[k] = (xorshift(seed) % 8) ? xorshift(seed) & xorshift(seed) : ~0ull;
+      for(int j=0; j<MSKLEN; j++){
+         if((bits[k] & (1ull << j)) && ref[lo + k*MSKLEN + j]!=UNSET){
+            ref[lo + k*MSKLEN + j] = UNSET;
+            want++;
+         }
+      }
+   }
+   // In a few uneven pieces, as separate threads would
+   for(int k=0; k<blocks; ){
+      int n = 1 + (int)(xorshift(seed) % 40);
+      n = (n > blocks - k) ? blocks - k : n;
+      got += csa_delete_bits(c, lo + k*MSKLEN, bits + k, n);
+      k += n;
+   }
+   assert(got==want);
+   assert(csa_delete_bits(c, lo + 1, bits, 1)==0);
+   csa_delete_end(c);
+   check_against(c, ref);
+   check_against(snap, old);
+   csa_free(&snap);
+   // Clearing everything leaves no directory, as csa_delete does
+   assert(csa_delete_begin(c, 0, RANGE));
+   for(int k=0; k<RANGE/MSKLEN; k++){
+      bits[k] = ~0ull;
+   }
+   csa_delete_bits(c, 0, bits, RANGE/MSKLEN);
+   csa_delete_end(c);
+   assert(c->n==0 && c->b==NULL && c->ndense==0);
+   // A long segment is split a stretch at a time, & reads the same afterwards
+   int* vals = (int*)malloc(LONG_RUN*MSKLEN * sizeof(int));
+   assert(vals);
+   for(int i=0; i<LONG_RUN*MSKLEN; i++){
+      vals[i] = i ^ (int)*seed;
+   }
+   assert(csa_set_range(c, 0, vals, LONG_RUN*MSKLEN) && c->ndense==1);
+   assert(csa_delete_begin(c, 0, LONG_RUN*MSKLEN) && c->ndense==0 && c->n==LONG_RUN);
+   for(int i=0, n; i<LONG_RUN*MSKLEN; i++){
+      assert(csa_get(c, i, &n) && n==vals[i]);
+   }
+   csa_delete_end(c);
+   free(vals);
+   csa_free(&c);
+   // Snapshots taken between batches, each deleting from other blocks : only
+   // the blocks a batch readied get shrunk, the rest may still be shared
+   static int refs[SNAPS][RANGE];
+   csa* snaps[SNAPS];
+   c = csa_init_policy(p);
+   for(int i=0; i<RANGE; i++){
+      ref[i] = (xorshift(seed) % 2) ? i : UNSET;
+      if(ref[i]!=UNSET){
+         assert(csa_set(c, i, i));
+      }
+   }
+   for(int k=0; k<SNAPS; k++){
+      int from = (int)(xorshift(seed) % (RANGE/MSKLEN)) * MSKLEN;
+      // Leaves one or two cells, so the block shrinks but stays
+      bits[0] = ~0ull << (1 + xorshift(seed) % 2);
+      for(int j=0; j<MSKLEN; j++){
+         if(bits[0] & (1ull << j)){
+            ref[from + j] = UNSET;
+         }
+      }
+      assert(csa_delete_begin(c, from, from + MSKLEN));
+      csa_delete_bits(c, from, bits, 1);
+      csa_delete_end(c);
+      check_against(c, ref);
+      assert((snaps[k] = csa_snapshot(c)));
+      memcpy(refs[k], ref, sizeof(ref));
+   }
+   for(int k=0; k<SNAPS; k++){
+      check_against(snaps[k], refs[k]);
+      csa_free(&snaps[k]);
+   }
+   csa_free(&c);
+}
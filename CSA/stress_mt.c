@@ -0,0 +1,107 @@
+// Many threads setting, deleting & reading one csa_mt at once.
+// Writers own interleaved indices, so they share blocks and keep
+// emptying & re-creating them, while readers check every value they
+// see belongs to the index it was read from.
+#include "csa_mt.h"
+#include "mydefs.h"
+
+#define RANGE   (MSKLEN*40)
+#define WRITERS 4
+#define READERS 4
+#define OPS     100000
+#define UNSET   INT_MIN
+
+struct worker {
+   csa_mt* c;
+   int id;
+   uint64_t seed;
+   int ref[RANGE];
+};
+
+uint64_t xorshift(uint64_t* s);
+void* writer(void* arg);
+void* reader(void* arg);
+
+int main(void)
+{
+   static struct worker w[WRITERS + READERS];
+   pthread_t t[WRITERS + READERS];
+   csa_mt* c = csa_mt_init();
+   for(int i=0; i<WRITERS + READERS; i++){
+      w[i].c = c;
+      w[i].id = i;
+      w[i].seed = 2463534242ull + i;
+      assert(pthread_create(&t[i], NULL, (i < WRITERS) ? writer : reader, &w[i])==0);
+   }
+   for(int i=0; i<WRITERS + READERS; i++){
+      assert(pthread_join(t[i], NULL)==0);
+   }
+
+   // Each cell ends up as its owner last left it
+   csa* plain = csa_init();
+   int n, count = 0;
+   for(int i=0; i<RANGE; i++){
+      int want = w[i % WRITERS].ref[i];
+      if(want==UNSET){
+         assert(!csa_mt_get(c, i, &n));
+      }
+      else{
+         assert(csa_mt_get(c, i, &n) && n==want);
+         assert(csa_set(plain, i, want));
+         count++;
+      }
+   }
+   assert(csa_mt_count(c)==count);
+   static char s1[BIGSTR], s2[BIGSTR];
+   csa_tostring(plain, s1);
+   csa_mt_tostring(c, s2);
+   assert(strcmp(s1, s2)==0);
+
+   csa_mt_free(&c);
+   assert(!c);
+   csa_free(&plain);
+   return EXIT_SUCCESS;
+}
+
+uint64_t xorshift(uint64_t* s)
+{
+   *s ^= *s << 13;
+   *s ^= *s >> 7;
+   *s ^= *s << 17;
+   return *s;
+}
+
+// Values are idx*8 + something, so readers can tell a value is in the right cell
+void* writer(void* arg)
+{
+   struct worker* w = (struct worker*)arg;
+   for(int i=0; i<RANGE; i++){
+      w->ref[i] = UNSET;
+   }
+   for(int op=0; op<OPS; op++){
+      int idx = (int)(xorshift(&w->seed) % (RANGE / WRITERS)) * WRITERS + w->id;
+      if(xorshift(&w->seed) % 2){
+         int val = idx*8 + (int)(xorshift(&w->seed) % 8);
+         assert(csa_mt_set(w->c, idx, val));
+         w->ref[idx] = val;
+      }
+      else{
+         assert(csa_mt_delete(w->c, idx)==(w->ref[idx]!=UNSET));
+         w->ref[idx] = UNSET;
+      }
+   }
+   return NULL;
+}
+
+void* reader(void* arg)
+{
+   struct worker* w = (struct worker*)arg;
+   int n;
+   for(int op=0; op<OPS; op++){
+      int idx = (int)(xorshift(&w->seed) % RANGE);
+      if(csa_mt_get(w->c, idx, &n)){
+         assert(n/8==idx);
+      }
+   }
+   return NULL;
+}
@@ -2,6 +2,9 @@
 
 #define BOARDSTR (MAX*MAX+1)
 #define NUMTOTALS 4
+#define NUMVALUES 2
+// Bits in a count of up to MAX cells
+#define COUNTBITS 5
 
 typedef enum {up, right, down, left, upDown, rightLeft} direction;
 typedef enum {row1s, row0s, col1s, col0s} tots;
@@ -10,26 +13,77 @@ typedef struct {
   int row;
   int col;
 } location;
+// Cells that need looking at again, as one bit per column for each row
+typedef struct {
+  uint16_t cells[MAX];
+  int sz;
+} worklist;
+// Cells filled in since the search began, in order, so they can be put back to UNK
+typedef struct {
+  location tiles[MAX*MAX];
+  int n;
+} trail;
 
 bool setSize(board* brd, char* str);
 bool fillGrid(board* brd, char* str);
 bool updateBoard(board* brd);
 bool tileCompleted(location* tile);
+bool applyRules(location* tile, ruleset* rs);
+bool applyRule(rule_id r, location* tile, ruleset* rs);
 bool solvePairsOxo(location* tile);
 bool isPair(location* tile, direction dir);
 char getValue(location* tile);
 void getPairCoordinates(direction dir, location* tile1, location* tile2);
 bool isOutOfBounds(location* tile);
 bool updateTile(location* tile, char newValue);
+void setTile(board* brd, int row, int col, char newValue);
+void countTiles(board* brd);
 bool isValidPlacement(location* tile);
 bool failsCounting(location* tile);
-int* getRowColTotals(location* tile);
+void getRowColTotals(location* tile, int totals[NUMTOTALS]);
 bool formsThree(location* tile);
 bool isThree(location* tile, direction dir);
 bool solveCounting(location* tile);
+bool solveUnique(location* tile);
+bool matchesLine(board* brd, int line, int other, bool isRow);
+bool solveLookahead(location* tile, ruleset* rs);
+bool leavesDeadEnd(location* tile, char newValue, ruleset* rs);
+bool wideRules(ruleset* rs);
 bool boardIsComplete(board* brd);
+void propagate(worklist* work, board* brd, trail* tr, ruleset* rs);
+int searchFrom(board* brd, trail* tr, ruleset* rs, long* nodes, int max);
+bool repeatsLine(board* brd);
+bool breaksRules(board* brd);
+bool isSolution(board* brd, ruleset* rs);
+int cellOptions(location* tile, char* only);
+bool mostConstrained(board* brd, location* best, int* options, char* only);
+void undoTrail(trail* tr, int mark);
+void queueUnknowns(worklist* work, board* brd);
+void queueTile(worklist* work, location* tile);
+void queueAround(worklist* work, location* tile);
+bool nextTile(worklist* work, location* tile);
+bool isPlainBoard(board* brd);
+bool settleBits(bitboard* bits);
+void rowDeductions(uint16_t* ones, uint16_t* zeros, int sz, uint16_t colHalf[NUMVALUES], uint16_t* newZeros, uint16_t* newOnes);
+void sliceCounts(uint16_t* masks, int sz, uint16_t counts[COUNTBITS]);
+uint16_t halfColumns(uint16_t* masks, int sz);
+int bitsSet(uint16_t x);
+bool bitsBreakRules(bitboard* bits);
+bool bitsComplete(bitboard* bits);
 //void printBoard(board* brd);
 
+// The rules applyRules() tries, in order, and whether default_rules() turns each on
+typedef struct {
+  const char* name;
+  bool on;
+} rule;
+static const rule rules[NUMRULES] = {
+  {"pairs/oxo", true},
+  {"counting", true},
+  {"unique", false},
+  {"lookahead", false}
+};
+
 
 bool str2board(board* brd, char* str) {
   if ((!brd) || (!str)) {
@@ -77,7 +131,13 @@ bool fillGrid(board* brd, char* str) {
   }
 
   // Check that we have reached the end of the string
-  return (str[str_index] == '\0');
+  if (str[str_index] != '\0') {
+    return false;
+  }
+
+  // The row and column counts the solver starts from
+  countTiles(brd);
+  return true;
 }
 
 
@@ -99,13 +159,312 @@ void board2str(char* str, board* brd) {
 
 
 bool solve_board(board* brd) {
+  ruleset rs;
+  default_rules(&rs);
+  return solve_rules(brd, &rs);
+}
+
+
+// Fills in cells in the same order repeated calls to updateBoard() would, but only
+// looks again at the cells a new value could have made a difference to
+bool solve_rules(board* brd, ruleset* rs) {
+  if ((!brd) || (!rs)) {
+    return false;
+  }
+
+  // The board may have been filled in by hand, rather than by str2board()
+  countTiles(brd);
+  worklist work;
+  queueUnknowns(&work, brd);
+  propagate(&work, brd, NULL, rs);
+  return boardIsComplete(brd);
+}
+
+
+// Applies the rules until the worklist runs dry, adding each cell filled to tr (if any).
+// The unique & lookahead rules read past a cell's own row and column, so while either
+// is on every unknown cell is looked at again whenever anything has been filled in.
+void propagate(worklist* work, board* brd, trail* tr, ruleset* rs) {
+  bool wide = wideRules(rs);
+  bool filled;
+  do {
+    filled = false;
+    location tile = {brd, 0, 0};
+    while (nextTile(work, &tile)) {
+      if ((brd->b2d[tile.row][tile.col] == UNK) && (applyRules(&tile, rs))) {
+        queueAround(work, &tile);
+        filled = true;
+        if (tr) {
+          tr->tiles[(tr->n)++] = tile;
+        }
+      }
+    }
+    if ((wide) && (filled)) {
+      queueUnknowns(work, brd);
+    }
+  } while ((wide) && (filled));
+}
+
+
+bool search_board(board* brd, ruleset* rs, long* nodes) {
+  long guesses = 0;
+  ruleset defaults;
+  if (nodes) {
+    *nodes = 0;
+  }
   if (!brd) {
     return false;
   }
+  if (!rs) {
+    default_rules(&defaults);
+    rs = &defaults;
+  }
 
-  while (updateBoard(brd)) {
+  // Everything the rules fill in before the first guess stays put
+  if (solve_rules(brd, rs)) {
+    return isSolution(brd, rs);
   }
-  return boardIsComplete(brd);
+  // Givens that break a rule can't be finished, however the gaps are filled
+  if (breaksRules(brd)) {
+    return false;
+  }
+  trail tr = {.n = 0};
+  bool solved = (searchFrom(brd, &tr, rs, &guesses, 1) == 1);
+  if (nodes) {
+    *nodes = guesses;
+  }
+  return solved;
+}
+
+
+int count_solutions(board* brd, ruleset* rs, int max) {
+  if ((!brd) || (max < 1)) {
+    return 0;
+  }
+  ruleset defaults;
+  if (!rs) {
+    default_rules(&defaults);
+    rs = &defaults;
+  }
+
+  board tmp = *brd;
+  if (solve_rules(&tmp, rs)) {
+    return (isSolution(&tmp, rs)) ? 1 : 0;
+  }
+  if (breaksRules(&tmp)) {
+    return 0;
+  }
+  trail tr = {.n = 0};
+  long nodes = 0;
+  return searchFrom(&tmp, &tr, rs, &nodes, max);
+}
+
+
+// Guesses at the most constrained cell, then propagates, recursing until the board is
+// full, and returns how many full boards it came to (stopping at max). A guess that
+// leaves a cell with no valid value is undone - the board is left as it was found
+// unless the max'th solution turns up.
+int searchFrom(board* brd, trail* tr, ruleset* rs, long* nodes, int max) {
+  location tile;
+  int options;
+  char only;
+  if (!mostConstrained(brd, &tile, &options, &only)) {
+    return (isSolution(brd, rs)) ? 1 : 0;
+  }
+
+  char values[NUMVALUES] = {ZERO, ONE};
+  if (options == 1) {
+    values[0] = only;
+  }
+  int found = 0;
+  for (int guess = 0; guess < options; guess++) {
+    int mark = tr->n;
+    (*nodes)++;
+    updateTile(&tile, values[guess]);
+    tr->tiles[(tr->n)++] = tile;
+
+    worklist work = {.sz = brd->sz};
+    if (wideRules(rs)) {
+      queueUnknowns(&work, brd);
+    } else {
+      queueAround(&work, &tile);
+    }
+    propagate(&work, brd, tr, rs);
+    found += searchFrom(brd, tr, rs, nodes, max - found);
+    if (found >= max) {
+      return found;
+    }
+    undoTrail(tr, mark);
+  }
+  return found;
+}
+
+
+// A full board that breaks no rule - no two lines may be the same either, if the
+// unique rule is on
+bool isSolution(board* brd, ruleset* rs) {
+  return ((!breaksRules(brd)) && ((!rs->on[rule_unique]) || (!repeatsLine(brd))));
+}
+
+
+// Whether the cells filled in so far already break a rule : three the same in a
+// row or column, or more than half of a row or column the same
+bool breaksRules(board* brd) {
+  int half = (brd->sz >> 1);
+  for (int line = 0; line < brd->sz; line++) {
+    if ((brd->rowOnes[line] > half) || (brd->rowZeros[line] > half) ||
+        (brd->colOnes[line] > half) || (brd->colZeros[line] > half)) {
+      return true;
+    }
+  }
+  for (int row = 0; row < brd->sz; row++) {
+    for (int col = 0; col < brd->sz; col++) {
+      char val = brd->b2d[row][col];
+      if (val == UNK) {
+        continue;
+      }
+      if ((col + 2 < brd->sz) && (brd->b2d[row][col + 1] == val) && (brd->b2d[row][col + 2] == val)) {
+        return true;
+      }
+      if ((row + 2 < brd->sz) && (brd->b2d[row + 1][col] == val) && (brd->b2d[row + 2][col] == val)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+
+// Whether any two rows, or any two columns, are the same
+bool repeatsLine(board* brd) {
+  for (int line = 0; line < brd->sz; line++) {
+    for (int other = line + 1; other < brd->sz; other++) {
+      bool sameRow = true, sameCol = true;
+      for (int index = 0; index < brd->sz; index++) {
+        sameRow = ((sameRow) && (brd->b2d[line][index] == brd->b2d[other][index]));
+        sameCol = ((sameCol) && (brd->b2d[index][line] == brd->b2d[index][other]));
+      }
+      if ((sameRow) || (sameCol)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+
+// How many of 0 and 1 are valid placements for an unknown cell - if just one, *only
+// is set to it
+int cellOptions(location* tile, char* only) {
+  int options = 0;
+  char values[NUMVALUES] = {ZERO, ONE};
+  for (int val = 0; val < NUMVALUES; val++) {
+    if (updateTile(tile, values[val])) {
+      setTile(tile->brd, tile->row, tile->col, UNK);
+      *only = values[val];
+      options++;
+    }
+  }
+  return options;
+}
+
+
+// The unknown cell with fewest valid values, breaking ties by how full its row and
+// column are. Returns false if there are no unknown cells left.
+bool mostConstrained(board* brd, location* best, int* options, char* only) {
+  int bestKnown = -1;
+  *options = NUMTOTALS;
+  for (int row = 0; row < brd->sz; row++) {
+    for (int col = 0; col < brd->sz; col++) {
+      if (brd->b2d[row][col] != UNK) {
+        continue;
+      }
+      location tile = {brd, row, col};
+      char val = UNK;
+      int opts = cellOptions(&tile, &val);
+      int known = brd->rowOnes[row] + brd->rowZeros[row] + brd->colOnes[col] + brd->colZeros[col];
+      if ((opts < *options) || ((opts == *options) && (known > bestKnown))) {
+        *best = tile;
+        *options = opts;
+        *only = val;
+        bestKnown = known;
+        if (opts == 0) {
+          return true; // Dead end - no point looking further
+        }
+      }
+    }
+  }
+  return (bestKnown >= 0);
+}
+
+
+// Puts every cell filled since the trail held mark entries back to UNK
+void undoTrail(trail* tr, int mark) {
+  while (tr->n > mark) {
+    location* tile = &tr->tiles[--(tr->n)];
+    setTile(tile->brd, tile->row, tile->col, UNK);
+  }
+}
+
+
+void queueUnknowns(worklist* work, board* brd) {
+  work->sz = brd->sz;
+  for (int row = 0; row < brd->sz; row++) {
+    work->cells[row] = 0;
+    for (int col = 0; col < brd->sz; col++) {
+      if (brd->b2d[row][col] == UNK) {
+        work->cells[row] |= (uint16_t)(1u << col);
+      }
+    }
+  }
+}
+
+
+void queueTile(worklist* work, location* tile) {
+  if ((!isOutOfBounds(tile)) && (getValue(tile) == UNK)) {
+    work->cells[tile->row] |= (uint16_t)(1u << tile->col);
+  }
+}
+
+
+// A cell's rules only read its own row and column : pairs and OXO up to 2 cells away,
+// and counting once either is half full. Placements that were invalid stay invalid, so
+// nothing else can have changed.
+void queueAround(worklist* work, location* tile) {
+  for (int dist = -2; dist <= 2; dist++) {
+    location inRow = {tile->brd, tile->row, tile->col + dist};
+    location inCol = {tile->brd, tile->row + dist, tile->col};
+    queueTile(work, &inRow);
+    queueTile(work, &inCol);
+  }
+
+  int totals[NUMTOTALS];
+  getRowColTotals(tile, totals);
+  int rowMax = (tile->brd->sz >> 1);
+  for (int index = 0; index < tile->brd->sz; index++) {
+    if ((totals[row1s] == rowMax) || (totals[row0s] == rowMax)) {
+      location inRow = {tile->brd, tile->row, index};
+      queueTile(work, &inRow);
+    }
+    if ((totals[col1s] == rowMax) || (totals[col0s] == rowMax)) {
+      location inCol = {tile->brd, index, tile->col};
+      queueTile(work, &inCol);
+    }
+  }
+}
+
+
+// Takes the first queued cell, scanning row by row, as updateBoard() would
+bool nextTile(worklist* work, location* tile) {
+  for (int row = 0; row < work->sz; row++) {
+    if (work->cells[row]) {
+      tile->row = row;
+      tile->col = __builtin_ctz(work->cells[row]);
+      work->cells[row] &= (uint16_t)(work->cells[row] - 1);
+      return true;
+    }
+  }
+  return false;
 }
 
 
@@ -127,6 +486,34 @@ bool tileCompleted(location* tile) {
 }
 
 
+// As tileCompleted(), but with the rules rs has on, counting which one filled the cell
+bool applyRules(location* tile, ruleset* rs) {
+  for (rule_id r = rule_pairs; r < NUMRULES; r++) {
+    if ((rs->on[r]) && (applyRule(r, tile, rs))) {
+      rs->hits[r]++;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool applyRule(rule_id r, location* tile, ruleset* rs) {
+  switch (r) {
+    case rule_pairs:
+      return solvePairsOxo(tile);
+    case rule_counting:
+      return solveCounting(tile);
+    case rule_unique:
+      return solveUnique(tile);
+    case rule_lookahead:
+      return solveLookahead(tile, rs);
+    default:
+      return false;
+  }
+}
+
+
 bool solvePairsOxo(location* tile) {
   for (direction dir = up; dir <= rightLeft; dir++) { // iterate through directions
     if (isPair(tile, dir)) {
@@ -203,56 +590,72 @@ void getPairCoordinates(direction dir, location* tile1, location* tile2) {
 
 
 bool updateTile(location* tile, char newValue) { 
-  tile->brd->b2d[tile->row][tile->col] = newValue;
+  setTile(tile->brd, tile->row, tile->col, newValue);
   if (isValidPlacement(tile)) {
     return true;
   } else {
-    tile->brd->b2d[tile->row][tile->col] = UNK;
+    setTile(tile->brd, tile->row, tile->col, UNK);
     return false;
   }
 }
 
 
+// Changes a cell, keeping the row & column counts in step
+void setTile(board* brd, int row, int col, char newValue) {
+  char oldValue = brd->b2d[row][col];
+  brd->rowOnes[row] -= (oldValue == ONE);
+  brd->colOnes[col] -= (oldValue == ONE);
+  brd->rowZeros[row] -= (oldValue == ZERO);
+  brd->colZeros[col] -= (oldValue == ZERO);
+
+  brd->b2d[row][col] = newValue;
+  brd->rowOnes[row] += (newValue == ONE);
+  brd->colOnes[col] += (newValue == ONE);
+  brd->rowZeros[row] += (newValue == ZERO);
+  brd->colZeros[col] += (newValue == ZERO);
+}
+
+
+void countTiles(board* brd) {
+  for (int index = 0; index < MAX; index++) {
+    brd->rowOnes[index] = brd->rowZeros[index] = 0;
+    brd->colOnes[index] = brd->colZeros[index] = 0;
+  }
+  for (int row = 0; row < brd->sz; row++) {
+    for (int col = 0; col < brd->sz; col++) {
+      brd->rowOnes[row] += (brd->b2d[row][col] == ONE);
+      brd->colOnes[col] += (brd->b2d[row][col] == ONE);
+      brd->rowZeros[row] += (brd->b2d[row][col] == ZERO);
+      brd->colZeros[col] += (brd->b2d[row][col] == ZERO);
+    }
+  }
+}
+
+
 bool isValidPlacement(location* tile) {
   return ((!failsCounting(tile)) && (!formsThree(tile)));
 }
 
 
 bool failsCounting(location* tile) {
-  int* totals = getRowColTotals(tile);
+  int totals[NUMTOTALS];
+  getRowColTotals(tile, totals);
   int rowMax = (tile->brd->sz >> 1);
 
   for (int tot = 0; tot < NUMTOTALS; tot++) {
     if (totals[tot] > rowMax) {
-      free(totals);
       return true;
     }
   }
-
-  free(totals);
   return false;
 }
 
 
-int* getRowColTotals(location* tile) {
-  int* totals = (int*)calloc(NUMTOTALS, sizeof(int));
-  
-  for (int index = 0; index < tile->brd->sz; index++) {
-    char rowVal = tile->brd->b2d[tile->row][index]; 
-    char colVal = tile->brd->b2d[index][tile->col]; 
-
-    if (rowVal == ONE) {
-      totals[row1s]++;
-    } else if (rowVal == ZERO) {
-      totals[row0s]++;
-    }
-    if (colVal == ONE) {
-      totals[col1s]++;
-    } else if (colVal == ZERO) {
-      totals[col0s]++;
-    }
-  }
-  return totals;
+void getRowColTotals(location* tile, int totals[NUMTOTALS]) {
+  totals[row1s] = tile->brd->rowOnes[tile->row];
+  totals[row0s] = tile->brd->rowZeros[tile->row];
+  totals[col1s] = tile->brd->colOnes[tile->col];
+  totals[col0s] = tile->brd->colZeros[tile->col];
 }
 
 
@@ -288,22 +691,373 @@ bool isThree(location* tile, direction dir) {
 
 
 bool solveCounting(location* tile) {
-  int* totals = getRowColTotals(tile);
+  int totals[NUMTOTALS];
+  getRowColTotals(tile, totals);
   int rowMax = (tile->brd->sz >> 1); // rowMax is half the row size
 
   if ((totals[row1s] == rowMax) || (totals[col1s] == rowMax)) {
-    free(totals);
     return updateTile(tile, ZERO);
   } else if ((totals[row0s] == rowMax) || (totals[col0s] == rowMax)) {
-    free(totals);
     return updateTile(tile, ONE);
   }
+  return false;
+}
+
+
+// Once a row is down to two unknowns, one of which must be a 1 and the other a 0, it
+// can't be finished the same way as any full row that agrees with it so far - so this
+// cell takes the opposite of that row's value. Likewise for columns.
+bool solveUnique(location* tile) {
+  board* brd = tile->brd;
+  int half = (brd->sz >> 1);
+  int rowVals[NUMVALUES] = {brd->rowZeros[tile->row], brd->rowOnes[tile->row]};
+  int colVals[NUMVALUES] = {brd->colZeros[tile->col], brd->colOnes[tile->col]};
 
-  free(totals);
+  for (int other = 0; other < brd->sz; other++) {
+    if ((rowVals[0] == half - 1) && (rowVals[1] == half - 1) && (other != tile->row) &&
+        (matchesLine(brd, tile->row, other, true))) {
+      return updateTile(tile, (brd->b2d[other][tile->col] == ONE) ? ZERO : ONE);
+    }
+    if ((colVals[0] == half - 1) && (colVals[1] == half - 1) && (other != tile->col) &&
+        (matchesLine(brd, tile->col, other, false))) {
+      return updateTile(tile, (brd->b2d[tile->row][other] == ONE) ? ZERO : ONE);
+    }
+  }
   return false;
 }
 
 
+// Whether row (or column) other is full, and agrees with line wherever line is known
+bool matchesLine(board* brd, int line, int other, bool isRow) {
+  for (int index = 0; index < brd->sz; index++) {
+    char lineVal = (isRow) ? brd->b2d[line][index] : brd->b2d[index][line];
+    char otherVal = (isRow) ? brd->b2d[other][index] : brd->b2d[index][other];
+    if ((otherVal != ONE) && (otherVal != ZERO)) {
+      return false;
+    }
+    if ((lineVal != UNK) && (lineVal != otherVal)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Tries each value here in turn, and if what the other rules then fill in leaves some
+// cell with nothing it can be, this cell must take the other value
+bool solveLookahead(location* tile, ruleset* rs) {
+  char values[NUMVALUES] = {ZERO, ONE};
+  for (int val = 0; val < NUMVALUES; val++) {
+    if ((leavesDeadEnd(tile, values[val], rs)) && (updateTile(tile, values[NUMVALUES - 1 - val]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Places newValue, propagates with the rules that don't look ahead, and checks the rows
+// and columns of every cell filled for one with no valid value left - then puts it all
+// back. What the rules do on the way doesn't count towards rs's hits. A value that
+// isn't valid in the first place isn't a dead end : the rules already see to that.
+bool leavesDeadEnd(location* tile, char newValue, ruleset* rs) {
+  if (!updateTile(tile, newValue)) {
+    return false;
+  }
+  ruleset inner = *rs;
+  inner.on[rule_lookahead] = false;
+
+  trail tr = {.n = 0};
+  tr.tiles[(tr.n)++] = *tile;
+  worklist work = {.sz = tile->brd->sz};
+  if (inner.on[rule_unique]) {
+    queueUnknowns(&work, tile->brd);
+  } else {
+    queueAround(&work, tile);
+  }
+  propagate(&work, tile->brd, &tr, &inner);
+
+  uint16_t rows = 0, cols = 0;
+  for (int index = 0; index < tr.n; index++) {
+    rows |= (uint16_t)(1u << tr.tiles[index].row);
+    cols |= (uint16_t)(1u << tr.tiles[index].col);
+  }
+  bool deadEnd = false;
+  char only;
+  for (int row = 0; (row < tile->brd->sz) && (!deadEnd); row++) {
+    for (int col = 0; (col < tile->brd->sz) && (!deadEnd); col++) {
+      location cell = {tile->brd, row, col};
+      bool touched = ((rows >> row) & 1) || ((cols >> col) & 1);
+      deadEnd = ((touched) && (getValue(&cell) == UNK) && (cellOptions(&cell, &only) == 0));
+    }
+  }
+
+  undoTrail(&tr, 0);
+  return deadEnd;
+}
+
+
+void default_rules(ruleset* rs) {
+  if (!rs) {
+    return;
+  }
+  for (rule_id r = rule_pairs; r < NUMRULES; r++) {
+    rs->on[r] = rules[r].on;
+    rs->hits[r] = 0;
+  }
+}
+
+
+const char* rule_name(rule_id r) {
+  return ((r >= rule_pairs) && (r < NUMRULES)) ? rules[r].name : "";
+}
+
+
+// Whether any rule is on that reads past a cell's own row and column
+bool wideRules(ruleset* rs) {
+  return ((rs->on[rule_unique]) || (rs->on[rule_lookahead]));
+}
+
+
+bool solve_bitboard(board* brd) {
+  if (!brd) {
+    return false;
+  }
+  // Anything but 0, 1 and . is left to solve_board()
+  if (!isPlainBoard(brd)) {
+    return solve_board(brd);
+  }
+
+  // The board may have been filled in by hand, rather than by str2board()
+  countTiles(brd);
+  bitboard bits;
+  board2bits(&bits, brd);
+  if (!settleBits(&bits)) {
+    return solve_board(brd);
+  }
+  bits2board(brd, &bits);
+  return bitsComplete(&bits);
+}
+
+
+bool isPlainBoard(board* brd) {
+  for (int row = 0; row < brd->sz; row++) {
+    for (int col = 0; col < brd->sz; col++) {
+      char val = brd->b2d[row][col];
+      if ((val != ONE) && (val != ZERO) && (val != UNK)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+// Starts from the board's own counts, which str2board() or the solver keep up to date
+void board2bits(bitboard* bits, board* brd) {
+  bits->sz = brd->sz;
+  for (int row = 0; row < MAX; row++) {
+    bits->ones[row] = bits->known[row] = 0;
+    bits->rowOnes[row] = brd->rowOnes[row];
+    bits->rowZeros[row] = brd->rowZeros[row];
+    bits->colOnes[row] = brd->colOnes[row];
+    bits->colZeros[row] = brd->colZeros[row];
+  }
+  for (int row = 0; row < brd->sz; row++) {
+    for (int col = 0; col < brd->sz; col++) {
+      uint16_t bit = (uint16_t)(1u << col);
+      bits->known[row] |= (brd->b2d[row][col] != UNK) ? bit : 0;
+      bits->ones[row] |= (brd->b2d[row][col] == ONE) ? bit : 0;
+    }
+  }
+}
+
+
+void bits2board(board* brd, bitboard* bits) {
+  brd->sz = bits->sz;
+  for (int row = 0; row < bits->sz; row++) {
+    for (int col = 0; col < bits->sz; col++) {
+      if (bits->known[row] & (1u << col)) {
+        brd->b2d[row][col] = (bits->ones[row] & (1u << col)) ? ONE : ZERO;
+      } else {
+        brd->b2d[row][col] = UNK;
+      }
+    }
+  }
+  for (int index = 0; index < MAX; index++) {
+    brd->rowOnes[index] = bits->rowOnes[index];
+    brd->rowZeros[index] = bits->rowZeros[index];
+    brd->colOnes[index] = bits->colOnes[index];
+    brd->colZeros[index] = bits->colZeros[index];
+  }
+}
+
+
+// Fills in every cell the rules force, sweeping down & up the rows and working out all
+// of a row's cells at once, until no row is left that may have something new. Returns
+// false if the rules contradict each other, or what's been filled in breaks a rule -
+// what's left then depends on the order cells are filled in, so the caller goes back to
+// solve_board(). Otherwise the result is the one solve_board() gives, as every cell it
+// fills is forced whatever order it goes in.
+bool settleBits(bitboard* bits) {
+  // Row r is at r + 2, with two empty rows either side so neighbours need no bounds checks
+  uint16_t ones[MAX + 4] = {0}, zeros[MAX + 4] = {0};
+  for (int row = 0; row < bits->sz; row++) {
+    ones[row + 2] = bits->ones[row];
+    zeros[row + 2] = bits->known[row] & ~bits->ones[row];
+  }
+
+  // Rows that may have something new : those within two of a row that's changed,
+  // and those with a gap in a column that's just reached half of either value
+  uint32_t allRows = (1u << bits->sz) - 1, dirty = allRows;
+  uint16_t colHalf[NUMVALUES] = {0, 0};
+  for (int sweep = 0; ; sweep++) {
+    uint16_t halfZeros = halfColumns(&zeros[2], bits->sz), halfOnes = halfColumns(&ones[2], bits->sz);
+    uint16_t reached = (uint16_t)((halfZeros & ~colHalf[0]) | (halfOnes & ~colHalf[1]));
+    colHalf[0] = halfZeros;
+    colHalf[1] = halfOnes;
+    for (int row = 0; (reached) && (row < bits->sz); row++) {
+      dirty |= (reached & ~(ones[row + 2] | zeros[row + 2])) ? (1u << row) : 0;
+    }
+    if (!dirty) {
+      break;
+    }
+
+    // Down, then up, so what one row gives the row above doesn't wait a sweep
+    for (int step = 0; step < bits->sz; step++) {
+      int row = (sweep & 1) ? (bits->sz - 1 - step) : step;
+      if (!((dirty >> row) & 1)) {
+        continue;
+      }
+      dirty &= ~(1u << row);
+      // What a row gives itself along the row is taken straight away
+      uint16_t newZeros, newOnes, was = ones[row + 2] | zeros[row + 2];
+      do {
+        rowDeductions(&ones[row + 2], &zeros[row + 2], bits->sz, colHalf, &newZeros, &newOnes);
+        if (newZeros & newOnes) {
+          return false;
+        }
+        ones[row + 2] |= newOnes;
+        zeros[row + 2] |= newZeros;
+      } while (newZeros | newOnes);
+      if ((ones[row + 2] | zeros[row + 2]) != was) {
+        dirty |= ((row < 2) ? (0x1Bu >> (2 - row)) : (0x1Bu << (row - 2))) & allRows;
+      }
+    }
+  }
+
+  uint16_t colOnes[COUNTBITS], colZeros[COUNTBITS];
+  sliceCounts(&ones[2], bits->sz, colOnes);
+  sliceCounts(&zeros[2], bits->sz, colZeros);
+  for (int index = 0; index < bits->sz; index++) {
+    bits->ones[index] = ones[index + 2];
+    bits->known[index] = ones[index + 2] | zeros[index + 2];
+    bits->rowOnes[index] = bitsSet(ones[index + 2]);
+    bits->rowZeros[index] = bitsSet(zeros[index + 2]);
+    bits->colOnes[index] = bits->colZeros[index] = 0;
+    for (int bit = 0; bit < COUNTBITS; bit++) {
+      bits->colOnes[index] |= ((colOnes[bit] >> index) & 1) << bit;
+      bits->colZeros[index] |= ((colZeros[bit] >> index) & 1) << bit;
+    }
+  }
+  return !bitsBreakRules(bits);
+}
+
+
+// The unknown cells of a row some rule gives a value, split by that value : next to,
+// or between, two of the same in the row or column, or in a row or column that
+// already has half its cells the other value. ones & zeros point at the row's own
+// masks, with the two rows above & below either side of them.
+void rowDeductions(uint16_t* ones, uint16_t* zeros, int sz, uint16_t colHalf[NUMVALUES], uint16_t* newZeros, uint16_t* newOnes) {
+  uint16_t full = (uint16_t)((1u << sz) - 1);
+  uint16_t unknown = (uint16_t)(~(ones[0] | zeros[0]) & full);
+
+  uint16_t onePairs = (ones[-1] & ones[-2]) | (ones[1] & ones[2]) | (ones[-1] & ones[1]) |
+                      ((ones[0] >> 1) & (ones[0] >> 2)) | ((ones[0] << 1) & (ones[0] << 2)) | ((ones[0] << 1) & (ones[0] >> 1));
+  uint16_t zeroPairs = (zeros[-1] & zeros[-2]) | (zeros[1] & zeros[2]) | (zeros[-1] & zeros[1]) |
+                       ((zeros[0] >> 1) & (zeros[0] >> 2)) | ((zeros[0] << 1) & (zeros[0] << 2)) | ((zeros[0] << 1) & (zeros[0] >> 1));
+  uint16_t rowHalfOnes = (bitsSet(ones[0]) == (sz >> 1)) ? full : 0;
+  uint16_t rowHalfZeros = (bitsSet(zeros[0]) == (sz >> 1)) ? full : 0;
+
+  *newZeros = (onePairs | rowHalfOnes | colHalf[1]) & unknown;
+  *newOnes = (zeroPairs | rowHalfZeros | colHalf[0]) & unknown;
+}
+
+
+// Adds up the sz rows of masks column by column, all at once : bit c of counts[b]
+// is bit b of how many rows have bit c set
+void sliceCounts(uint16_t* masks, int sz, uint16_t counts[COUNTBITS]) {
+  for (int bit = 0; bit < COUNTBITS; bit++) {
+    counts[bit] = 0;
+  }
+  for (int row = 0; row < sz; row++) {
+    uint16_t carry = masks[row];
+    for (int bit = 0; bit < COUNTBITS; bit++) {
+      uint16_t next = counts[bit] & carry;
+      counts[bit] ^= carry;
+      carry = next;
+    }
+  }
+}
+
+
+// The columns with exactly half their sz cells set in masks
+uint16_t halfColumns(uint16_t* masks, int sz) {
+  uint16_t counts[COUNTBITS];
+  sliceCounts(masks, sz, counts);
+  uint16_t equal = (uint16_t)((1u << sz) - 1);
+  for (int bit = 0; bit < COUNTBITS; bit++) {
+    equal &= (((sz >> 1) >> bit) & 1) ? counts[bit] : (uint16_t)~counts[bit];
+  }
+  return equal;
+}
+
+
+// How many bits of x are set, without a call for the compiler to make
+int bitsSet(uint16_t x) {
+  x = (uint16_t)(x - ((x >> 1) & 0x5555));
+  x = (uint16_t)((x & 0x3333) + ((x >> 2) & 0x3333));
+  x = (uint16_t)((x + (x >> 4)) & 0x0F0F);
+  return (x + (x >> 8)) & 0x1F;
+}
+
+
+// As breaksRules(), three shifts & ANDs a row
+bool bitsBreakRules(bitboard* bits) {
+  int half = (bits->sz >> 1);
+  for (int line = 0; line < bits->sz; line++) {
+    if ((bits->rowOnes[line] > half) || (bits->rowZeros[line] > half) ||
+        (bits->colOnes[line] > half) || (bits->colZeros[line] > half)) {
+      return true;
+    }
+  }
+  for (int row = 0; row < bits->sz; row++) {
+    uint16_t ones = bits->ones[row], zeros = bits->known[row] & ~ones;
+    if ((ones & (ones >> 1) & (ones >> 2)) || (zeros & (zeros >> 1) & (zeros >> 2))) {
+      return true;
+    }
+    if (row + 2 < bits->sz) {
+      uint16_t zeros1 = bits->known[row + 1] & ~bits->ones[row + 1], zeros2 = bits->known[row + 2] & ~bits->ones[row + 2];
+      if ((ones & bits->ones[row + 1] & bits->ones[row + 2]) || (zeros & zeros1 & zeros2)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+
+bool bitsComplete(bitboard* bits) {
+  uint16_t full = (uint16_t)((1u << bits->sz) - 1);
+  for (int row = 0; row < bits->sz; row++) {
+    if (bits->known[row] != full) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
 bool boardIsComplete(board* brd) {
   for (int row = 0; row < brd->sz; row++) {
     for (int col = 0; col < brd->sz; col++) {
@@ -395,6 +1149,153 @@ void test(void) {
   board2str(str, &brd);
   assert(strcmp(str, "101...001101010...1........1......0.") == 0);
 
+  // solve_bitboard(board* brd) - should match solve_board() exactly
+  str2board(&brd, "1..0....00.1.00..1......00.1...1..00");
+  assert(solve_bitboard(&brd));
+  board2str(str, &brd);
+  assert(strcmp(str, "101010010011100101011010001101110100") == 0);
+  assert((brd.rowOnes[0] == 3) && (brd.colZeros[5] == 3)); // Counts kept in step
+
+  str2board(&brd, "1..0........0..1");
+  assert(!solve_bitboard(&brd));
+  board2str(str, &brd);
+  assert(strcmp(str, "1..0........0..1") == 0);
+
+  str2board(&brd, "..1...00.1..0..............1......0.");
+  assert(!solve_bitboard(&brd));
+  board2str(str, &brd);
+  assert(strcmp(str, "101...001101010...1........1......0.") == 0);
+
+  str2board(&brd, "11.0"); // The rules contradict each other, so solve_board() decides
+  assert(!solve_bitboard(&brd));
+  board2str(str, &brd);
+  assert(strcmp(str, "11.0") == 0);
+
+  // board2bits(bitboard* bits, board* brd) and bits2board(board* brd, bitboard* bits)
+  bitboard bits;
+  str2board(&brd, "011.....0.011001");
+  board2bits(&bits, &brd);
+  assert((bits.ones[0] == 0x6) && (bits.known[0] == 0x7));
+  assert((bits.ones[3] == 0x9) && (bits.known[3] == 0xF));
+  assert((bits.rowOnes[0] == 2) && (bits.colZeros[0] == 2));
+  bits2board(&brd, &bits);
+  board2str(str, &brd);
+  assert(strcmp(str, "011.....0.011001") == 0);
+
+  // search_board(board* brd, ruleset* rs, long* nodes)
+  long nodes;
+  str2board(&brd, "................");
+  assert(search_board(&brd, NULL, &nodes)); // The rules alone can't start on this
+  assert(nodes > 0);
+  board2str(str, &brd);
+  assert(strcmp(str, "0011001111001100") == 0);
+
+  str2board(&brd, "1..0........0..1");
+  assert(search_board(&brd, NULL, NULL));
+  board2str(str, &brd);
+  assert(strcmp(str, "1010010111000011") == 0);
+
+  str2board(&brd, "011.....0.011001");
+  assert(search_board(&brd, NULL, &nodes));
+  assert(nodes == 0); // Solved without guessing
+
+  str2board(&brd, "11..");
+  assert(!search_board(&brd, NULL, &nodes));
+  board2str(str, &brd);
+  assert(strcmp(str, "110.") == 0); // Left as solve_board() leaves it
+
+  // count_solutions(board* brd, ruleset* rs, int max)
+  str2board(&brd, ".1.100.10.1....0.1.1...1101..0.0.1..");
+  assert(count_solutions(&brd, NULL, 2) == 1);
+  board2str(str, &brd);
+  assert(strcmp(str, ".1.100.10.1....0.1.1...1101..0.0.1..") == 0); // Left alone
+  str2board(&brd, "................");
+  assert(count_solutions(&brd, NULL, 100) == 90);
+  assert(count_solutions(&brd, NULL, 5) == 5);
+  str2board(&brd, "11..");
+  assert(count_solutions(&brd, NULL, 2) == 0);
+  str2board(&brd, ".010..1..0111101"); // Three 1s in the last row to begin with
+  assert(count_solutions(&brd, NULL, 2) == 0);
+  assert(!search_board(&brd, NULL, NULL));
+  str2board(&brd, "1111000011110000"); // Full, but wrong
+  assert(count_solutions(&brd, NULL, 2) == 0);
+  assert(!search_board(&brd, NULL, NULL));
+  str2board(&brd, "0011110000111100");
+  assert(count_solutions(&brd, NULL, 2) == 1);
+  assert(search_board(&brd, NULL, NULL));
+
+  // breaksRules(board* brd)
+  str2board(&brd, "0.1.0.1.1.0.1.0.");
+  assert(!breaksRules(&brd));
+  str2board(&brd, "0...0...0.......");
+  assert(breaksRules(&brd)); // Three in a column
+  str2board(&brd, "1.1.....1.......");
+  assert(!breaksRules(&brd));
+  str2board(&brd, "1.11............");
+  assert(breaksRules(&brd)); // Over half a row
+
+  // default_rules(ruleset* rs), solve_rules(board* brd, ruleset* rs) and the unique & lookahead rules
+  ruleset rs;
+  default_rules(&rs);
+  assert(rs.on[rule_pairs] && rs.on[rule_counting]);
+  assert(!rs.on[rule_unique] && !rs.on[rule_lookahead]); // Off unless asked for
+  assert(strcmp(rule_name(rule_unique), "unique") == 0);
+
+  str2board(&brd, "01010.........1.");
+  assert(!solve_rules(&brd, &rs));
+  board2str(str, &brd);
+  assert(strcmp(str, "01010...1...1010") == 0);
+  assert((rs.hits[rule_pairs] == 2) && (rs.hits[rule_counting] == 2));
+  default_rules(&rs);
+  rs.on[rule_unique] = true;
+  str2board(&brd, "01010.........1.");
+  assert(!solve_rules(&brd, &rs));
+  board2str(str, &brd);
+  assert(strcmp(str, "01010.1.1.0.1010") == 0); // Row 1 can't be 0101 like row 0
+  assert(rs.hits[rule_unique] == 1);
+  str2board(&brd, "................");
+  assert(count_solutions(&brd, &rs, 100) == 72); // Only those with no two rows or columns the same
+  assert(count_solutions(&brd, NULL, 100) == 90); // Each solve has rules of its own
+
+  str2board(&brd, ".1.100.10.1....0.1.1...1101..0.0.1..");
+  assert(!solve_board(&brd));
+  default_rules(&rs);
+  rs.on[rule_lookahead] = true;
+  str2board(&brd, ".1.100.10.1....0.1.1...1101..0.0.1..");
+  assert(solve_rules(&brd, &rs));
+  board2str(str, &brd);
+  assert(strcmp(str, "110100110010001011010101101010001101") == 0);
+  assert(rs.hits[rule_lookahead] > 0);
+
+  // queueUnknowns(worklist* work, board* brd) and nextTile(worklist* work, location* tile)
+  worklist work;
+  str2board(&brd, "1.0..1.0........");
+  queueUnknowns(&work, &brd);
+  assert(work.cells[0] == 0xA && work.cells[1] == 0x5 && work.cells[3] == 0xF);
+  tile = (location){.brd = &brd, .row = 0, .col = 0};
+  assert(nextTile(&work, &tile));
+  assert((tile.row == 0) && (tile.col == 1));
+  assert(nextTile(&work, &tile));
+  assert((tile.row == 0) && (tile.col == 3));
+  assert(nextTile(&work, &tile));
+  assert((tile.row == 1) && (tile.col == 0));
+  work = (worklist){.sz = 4};
+  assert(!nextTile(&work, &tile));
+
+  // queueAround(worklist* work, location* tile)
+  str2board(&brd, "1....1.....1....");
+  work = (worklist){.sz = 4};
+  tile = (location){.brd = &brd, .row = 1, .col = 1};
+  queueAround(&work, &tile); // Unknowns up to 2 away in row 1 & col 1
+  assert(work.cells[0] == 0x2 && work.cells[1] == 0xD && work.cells[2] == 0x2);
+  assert(work.cells[3] == 0x2);
+
+  str2board(&brd, "1...11..........");
+  work = (worklist){.sz = 4};
+  tile = (location){.brd = &brd, .row = 1, .col = 0};
+  queueAround(&work, &tile); // Row 1 & col 0 are half 1s, so both are queued in full
+  assert(work.cells[1] == 0xC && work.cells[2] == 0x1 && work.cells[3] == 0x1);
+
   // updateBoard(board* brd)
   str2board(&brd, "..1...00.1..0..............1......0.");
   assert(updateBoard(&brd));
@@ -462,11 +1363,11 @@ void test(void) {
   tile = (location){.brd = &brd, .row = 5, .col = 2};
   assert(!solvePairsOxo(&tile)); // Not enough info
 
-  brd.b2d[1][0] = ONE;
+  setTile(&brd, 1, 0, ONE);
   tile = (location){.brd = &brd, .row = 1, .col = 1};
   assert(!solvePairsOxo(&tile)); // Would lead to impossible row
 
-  brd.b2d[2][3] = ZERO;
+  setTile(&brd, 2, 3, ZERO);
   tile = (location){.brd = &brd, .row = 3, .col = 3};
   assert(!solvePairsOxo(&tile)); // Would lead to three consecutive same values
 
@@ -585,11 +1486,26 @@ void test(void) {
   assert(updateTile(&tile, ONE));
   assert(brd.b2d[tile.row][tile.col] == ONE);
 
-  brd.b2d[4][4] = ZERO;
+  setTile(&brd, 4, 4, ZERO);
   tile = (location){.brd = &brd, .row = 4, .col = 5};
   assert(!updateTile(&tile, ZERO)); // Should fail because would make illegal row
   assert(brd.b2d[tile.row][tile.col] == UNK);
 
+  // setTile(board* brd, int row, int col, char newValue) and countTiles(board* brd)
+  board saved = brd; // Put back afterwards for the tests below
+  str2board(&brd, "1..0....00.1.00..1......00.1...1..00");
+  assert((brd.rowOnes[0] == 1) && (brd.rowZeros[0] == 1) && (brd.colZeros[0] == 1));
+  setTile(&brd, 0, 1, ZERO);
+  assert((brd.rowZeros[0] == 2) && (brd.colZeros[1] == 3));
+  setTile(&brd, 0, 1, ONE);
+  assert((brd.rowZeros[0] == 1) && (brd.rowOnes[0] == 2) && (brd.colOnes[1] == 2));
+  setTile(&brd, 0, 1, UNK);
+  assert((brd.rowOnes[0] == 1) && (brd.colOnes[1] == 1) && (brd.colZeros[1] == 2));
+  brd.b2d[5][5] = ONE;
+  countTiles(&brd);
+  assert((brd.rowOnes[5] == 2) && (brd.rowZeros[5] == 1) && (brd.colOnes[5] == 3));
+  brd = saved;
+
   // isValidPlacement(location* tile)
   tile = (location){.brd = &brd, .row = 2, .col = 2};
   assert(isValidPlacement(&tile));
@@ -600,28 +1516,28 @@ void test(void) {
   tile = (location){.brd = &brd, .row = 5, .col = 4};
   assert(isValidPlacement(&tile));
 
-  brd.b2d[3][2] = ZERO;
+  setTile(&brd, 3, 2, ZERO);
   tile = (location){.brd = &brd, .row = 3, .col = 2};
   assert(!isValidPlacement(&tile)); // Three of a kind above
 
-  brd.b2d[5][3] = ZERO;
+  setTile(&brd, 5, 3, ZERO);
   tile = (location){.brd = &brd, .row = 5, .col = 3};
   assert(!isValidPlacement(&tile)); // Four 0s in col
   
   // failsCounting(location* tile)
   assert(failsCounting(&tile)); // Four 0s in col
 
-  brd.b2d[3][5] = ONE;
-  brd.b2d[0][5] = ONE;
+  setTile(&brd, 3, 5, ONE);
+  setTile(&brd, 0, 5, ONE);
   tile = (location){.brd = &brd, .row = 0, .col = 5};
   assert(failsCounting(&tile)); // Four 1s in col
 
-  brd.b2d[4][4] = ZERO;
-  brd.b2d[4][5] = ZERO;
+  setTile(&brd, 4, 4, ZERO);
+  setTile(&brd, 4, 5, ZERO);
   tile = (location){.brd = &brd, .row = 4, .col = 4};
   assert(failsCounting(&tile)); // Four 0s in row
 
-  brd.b2d[0][1] = ONE;
+  setTile(&brd, 0, 1, ONE);
   tile = (location){.brd = &brd, .row = 0, .col = 2};
   assert(failsCounting(&tile)); // Four 1s in row
 
@@ -632,30 +1548,28 @@ void test(void) {
   tile = (location){.brd = &brd, .row = 5, .col = 4};
   assert(!failsCounting(&tile)); 
 
-  // getTotals(location* tile)
-  int* totals = getRowColTotals(&tile);
+  // getRowColTotals(location* tile, int totals[NUMTOTALS])
+  int totals[NUMTOTALS];
+  getRowColTotals(&tile, totals);
   assert(totals[row1s] == 1);
   assert(totals[row0s] == 3);
   assert(totals[col1s] == 0);
   assert(totals[col0s] == 3);
-  free(totals);
 
   tile = (location){.brd = &brd, .row = 2, .col = 3};
-  totals = getRowColTotals(&tile);
+  getRowColTotals(&tile, totals);
   assert(totals[row1s] == 3);
   assert(totals[row0s] == 3);
   assert(totals[col1s] == 2);
   assert(totals[col0s] == 4);
-  free(totals);
 
 
   tile = (location){.brd = &brd, .row = 1, .col = 0};
-  totals = getRowColTotals(&tile);
+  getRowColTotals(&tile, totals);
   assert(totals[row1s] == 2);
   assert(totals[row0s] == 2);
   assert(totals[col1s] == 2);
   assert(totals[col0s] == 1);
-  free(totals);
 
   // formsThree(location* tile) and isThree(location* tile, direction dir)
   tile = (location){.brd = &brd, .row = 0, .col = 0};
@@ -6,6 +6,7 @@
 #include <time.h>
 #include <math.h>
 #include <assert.h>
+#include <stdint.h>
 
 // Maximum grid is 16x16
 #define MAX  16
@@ -17,6 +18,12 @@
 struct board {
    char b2d[MAX][MAX];
    int sz;
+   // How many 1s and 0s each row and column holds - str2board() works these out,
+   // and the solver keeps them up to date as it fills cells in
+   int rowOnes[MAX];
+   int rowZeros[MAX];
+   int colOnes[MAX];
+   int colZeros[MAX];
 };
 typedef struct board board;
 
@@ -29,3 +36,53 @@ bool str2board(board* b, char* str);
 void board2str(char* str, board* brd);
 // Given a board, apply all rules repatedly - return true if solved, false otherwise
 bool solve_board(board* brd);
+// The rules a solve can use, in the order each cell tries them. Only pairs/OXO &
+// counting are on to begin with, so solve_board() gives the results it always has :
+//    rule_unique    - no two rows, or two columns, may be the same
+//    rule_lookahead - a value that leaves a cell in the same row or column with
+//                     no valid value can't be right, so the cell takes the other
+typedef enum {rule_pairs, rule_counting, rule_unique, rule_lookahead, NUMRULES} rule_id;
+// Which rules one solve uses, and how many cells each has filled in
+struct ruleset {
+   bool on[NUMRULES];
+   long hits[NUMRULES];
+};
+typedef struct ruleset ruleset;
+// Just pairs/OXO & counting on, as solve_board() uses, and no hits yet
+void default_rules(ruleset* rs);
+const char* rule_name(rule_id r);
+// As solve_board(), but with the rules rs has on, adding to its hits
+bool solve_rules(board* brd, ruleset* rs);
+// As solve_rules(), but once the rules get stuck guesses a value for the cell with
+// fewest options left, carries on from there, and backs up to try the other value
+// if that leads nowhere. Returns true with the first solution found, or false if
+// there isn't one (as when the givens already break a rule) - the board is then
+// left as solve_rules() would leave it. If nodes isn't NULL it's set to how many
+// guesses were made. A NULL rs means the default rules.
+bool search_board(board* brd, ruleset* rs, long* nodes);
+// How many solutions search_board() could find, counting no further than max. The
+// board is left as it was.
+int count_solutions(board* brd, ruleset* rs, int max);
+
+// The same board as bit masks : bit c of a row's masks is column c. A cell is known
+// if its bit is set in known, and is then a 1 if its bit is set in ones as well.
+// Columns are read a row at a time, so only their counts are kept.
+struct bitboard {
+   uint16_t ones[MAX];
+   uint16_t known[MAX];
+   int rowOnes[MAX];
+   int rowZeros[MAX];
+   int colOnes[MAX];
+   int colZeros[MAX];
+   int sz;
+};
+typedef struct bitboard bitboard;
+
+// As solve_board(), with the same result, but working out every pair, OXO & counting
+// deduction for a whole row at once on a bitboard. Boards the rules find a contradiction
+// in, or with anything other than 0, 1 and . in them, are passed to solve_board()
+// instead, as what's left on those depends on the order cells are filled in.
+bool solve_bitboard(board* brd);
+// Convert between the two forms
+void board2bits(bitboard* bits, board* brd);
+void bits2board(board* brd, bitboard* bits);
@@ -0,0 +1,440 @@
+#include "bingrid.h"
+
+// Benchmarks the solvers on generated puzzles.
+// Usage : ./bingrid_bench [puzzles [seed]]
+
+#define BOARDSTR (MAX*MAX+1)
+#define SIZE     16
+#define PUZZLES  200
+// Cells tried before fillSolution() starts again from scratch
+#define TRIES    10000
+// Times round the driver's puzzles
+#define REPEATS  20000
+// Most clues blanked from each puzzle to make one the rules get stuck on
+#define BLANKS   4
+// How many of those to make, at most - each takes a while
+#define HARD     50
+// Goes at blanking each puzzle before giving up on it
+#define HARD_TRIES 20
+// Random boards, solvable or not, that both solvers must agree on
+#define RANDOMS  2000
+typedef bool (*solver)(board* brd);
+
+uint64_t xorshift(uint64_t* s);
+double now(void);
+bool fillSolution(board* brd, int cell, uint64_t* seed, int* tries);
+bool canPlace(board* brd, int row, int col, char val);
+void makePuzzle(board* puzzle, board* solution, uint64_t* seed);
+bool solvesTo(board* puzzle, board* solution);
+double timeSolver(solver solve, board* puzzles, int n, char results[][BOARDSTR], int* solved);
+void randomBoard(board* brd, uint64_t* seed);
+double timeDriver(solver solve);
+board* makeHard(board* puzzles, int n, uint64_t* seed, int* made);
+void timeSearch(board* hard, int n);
+void timeRules(board* hard, int n);
+void setRules(ruleset* rs, bool unique, bool lookahead);
+bool isSolutionTo(board* brd, board* puzzle);
+int cmpDouble(const void* a, const void* b);
+int cmpLong(const void* a, const void* b);
+
+int main(int argc, char* argv[])
+{
+   int n = (argc > 1) ? atoi(argv[1]) : PUZZLES;
+   uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 10) : 88172645463325252ull;
+   if(n < 1 || seed == 0){
+      fprintf(stderr, "Usage : %s [puzzles [seed]]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   board* puzzles = (board*)malloc(n * sizeof(board));
+   char (*before)[BOARDSTR] = malloc(n * sizeof(*before));
+   char (*after)[BOARDSTR] = malloc(n * sizeof(*after));
+   assert(puzzles && before && after);
+
+   // Each puzzle has as few clues as the rules still solve it from
+   double t = now();
+   int clues = 0;
+   for(int i=0; i<n; i++){
+      board solution;
+      solution.sz = SIZE;
+      int tries = TRIES;
+      while(!fillSolution(&solution, 0, &seed, &tries)){
+         tries = TRIES;
+      }
+      makePuzzle(&puzzles[i], &solution, &seed);
+      for(int j=0; j<SIZE*SIZE; j++){
+         clues += (puzzles[i].b2d[j/SIZE][j%SIZE] != UNK);
+      }
+   }
+   printf("%d %dx%d puzzles, %.1f clues each on average, made in %.2f s\n",
+          n, SIZE, SIZE, (double)clues / n, now() - t);
+
+   int solvedChar, solvedBits;
+   double tChar = timeSolver(solve_board, puzzles, n, before, &solvedChar);
+   double tBits = timeSolver(solve_bitboard, puzzles, n, after, &solvedBits);
+   for(int i=0; i<n; i++){
+      assert(strcmp(before[i], after[i]) == 0);
+   }
+   assert(solvedChar == n && solvedBits == n);
+   printf("solve_board    : %9.1f us per puzzle\n", tChar * 1e6 / n);
+   printf("solve_bitboard : %9.1f us per puzzle (%.1fx the speed)\n", tBits * 1e6 / n, tChar / tBits);
+
+   // The same answers on boards that are contradictory, or that the rules get stuck on
+   for(int i=0; i<RANDOMS; i++){
+      board a, b;
+      char sa[BOARDSTR], sb[BOARDSTR];
+      randomBoard(&a, &seed);
+      b = a;
+      assert(solve_board(&a) == solve_bitboard(&b));
+      board2str(sa, &a);
+      board2str(sb, &b);
+      assert(strcmp(sa, sb) == 0);
+   }
+   printf("%d random boards of every size solved the same way by both\n", RANDOMS);
+
+   // The small boards bingrid_driver.c checks, solvable or not
+   tChar = timeDriver(solve_board);
+   tBits = timeDriver(solve_bitboard);
+   printf("driver puzzles : %9.2f us (solve_board), %.2f us (solve_bitboard) per puzzle\n",
+          tChar * 1e6, tBits * 1e6);
+
+   int nHard;
+   t = now();
+   board* hard = makeHard(puzzles, (n < HARD) ? n : HARD, &seed, &nHard);
+   printf("%d puzzles the rules get stuck on, with one solution each, made in %.2f s\n", nHard, now() - t);
+   if(nHard > 0){
+      timeSearch(hard, nHard);
+      timeRules(hard, nHard);
+   }
+
+   free(hard);
+   free(puzzles);
+   free(before);
+   free(after);
+   return EXIT_SUCCESS;
+}
+
+uint64_t xorshift(uint64_t* s)
+{
+   *s ^= *s << 13;
+   *s ^= *s >> 7;
+   *s ^= *s << 17;
+   return *s;
+}
+
+double now(void)
+{
+   return (double)clock() / CLOCKS_PER_SEC;
+}
+
+// Fills cells from `cell` on (row by row) with random values that break no rule,
+// backtracking when it gets stuck - gives up once *tries runs out
+bool fillSolution(board* brd, int cell, uint64_t* seed, int* tries)
+{
+   if(cell == brd->sz * brd->sz){
+      return true;
+   }
+   if(--(*tries) < 0){
+      return false;
+   }
+   int row = cell / brd->sz, col = cell % brd->sz;
+   char first = (xorshift(seed) & 1) ? ONE : ZERO;
+   char vals[2] = {first, (first == ONE) ? ZERO : ONE};
+   for(int v=0; v<2; v++){
+      if(canPlace(brd, row, col, vals[v])){
+         brd->b2d[row][col] = vals[v];
+         if(fillSolution(brd, cell+1, seed, tries)){
+            return true;
+         }
+      }
+   }
+   brd->b2d[row][col] = UNK;
+   return false;
+}
+
+// No three in a row ending here, no more than half a row or column the same,
+// and no row or column the same as an earlier one once it's finished
+bool canPlace(board* brd, int row, int col, char val)
+{
+   int sz = brd->sz;
+   brd->b2d[row][col] = val;
+   for(int other=0; other<row && col==sz-1; other++){
+      if(memcmp(brd->b2d[other], brd->b2d[row], sz) == 0){
+         brd->b2d[row][col] = UNK;
+         return false;
+      }
+   }
+   for(int other=0; other<col && row==sz-1; other++){
+      int i = 0;
+      while(i < sz && brd->b2d[i][other] == brd->b2d[i][col]){
+         i++;
+      }
+      if(i == sz){
+         brd->b2d[row][col] = UNK;
+         return false;
+      }
+   }
+   brd->b2d[row][col] = UNK;
+
+   if(col >= 2 && brd->b2d[row][col-1] == val && brd->b2d[row][col-2] == val){
+      return false;
+   }
+   if(row >= 2 && brd->b2d[row-1][col] == val && brd->b2d[row-2][col] == val){
+      return false;
+   }
+   int inRow = 1, inCol = 1;
+   for(int i=0; i<col; i++){
+      inRow += (brd->b2d[row][i] == val);
+   }
+   for(int i=0; i<row; i++){
+      inCol += (brd->b2d[i][col] == val);
+   }
+   return (inRow <= brd->sz/2) && (inCol <= brd->sz/2);
+}
+
+// Blanks cells of the solution in a random order, keeping each blank only
+// if the rules can still work back to the solution
+void makePuzzle(board* puzzle, board* solution, uint64_t* seed)
+{
+   int cells = solution->sz * solution->sz;
+   int order[MAX*MAX];
+   for(int i=0; i<cells; i++){
+      order[i] = i;
+   }
+   for(int i=cells-1; i>0; i--){
+      int j = (int)(xorshift(seed) % (i+1));
+      int tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+   }
+   *puzzle = *solution;
+   for(int i=0; i<cells; i++){
+      int row = order[i] / solution->sz, col = order[i] % solution->sz;
+      puzzle->b2d[row][col] = UNK;
+      if(!solvesTo(puzzle, solution)){
+         puzzle->b2d[row][col] = solution->b2d[row][col];
+      }
+   }
+}
+
+bool solvesTo(board* puzzle, board* solution)
+{
+   board tmp = *puzzle;
+   char a[BOARDSTR], b[BOARDSTR];
+   if(!solve_board(&tmp)){
+      return false;
+   }
+   board2str(a, &tmp);
+   board2str(b, solution);
+   return strcmp(a, b) == 0;
+}
+
+// Seconds for solve() to go through all n puzzles, keeping what it left in results
+double timeSolver(solver solve, board* puzzles, int n, char results[][BOARDSTR], int* solved)
+{
+   *solved = 0;
+   double t = now();
+   for(int i=0; i<n; i++){
+      board tmp = puzzles[i];
+      *solved += solve(&tmp);
+      board2str(results[i], &tmp);
+   }
+   return now() - t;
+}
+
+// Any even size, with each cell 1, 0 or unknown at random
+void randomBoard(board* brd, uint64_t* seed)
+{
+   brd->sz = 2 * (int)(1 + xorshift(seed) % (MAX/2));
+   int unknown = (int)(xorshift(seed) % 100);
+   for(int row=0; row<brd->sz; row++){
+      for(int col=0; col<brd->sz; col++){
+         int r = (int)(xorshift(seed) % 100);
+         brd->b2d[row][col] = (r < unknown) ? UNK : ((r & 1) ? ONE : ZERO);
+      }
+   }
+}
+
+// Seconds per puzzle for solve() to go through each of bingrid_driver.c's boards REPEATS times
+double timeDriver(solver solve)
+{
+   static char* strs[] = {".0..", "...1.0......1..1", "....0.0....1..0.", "...1.0.........1",
+                          "1...1...0.....00...1................",
+                          "....0...1.....11...0................",
+                          "0.............0.00...1.....00.......0.....0..1.......00........."};
+   int n = (int)(sizeof(strs) / sizeof(strs[0]));
+   board puzzles[sizeof(strs) / sizeof(strs[0])];
+   for(int i=0; i<n; i++){
+      assert(str2board(&puzzles[i], strs[i]));
+   }
+   double t = now();
+   for(int r=0; r<REPEATS; r++){
+      for(int i=0; i<n; i++){
+         board tmp = puzzles[i];
+         solve(&tmp);
+      }
+   }
+   return (now() - t) / ((double)REPEATS * n);
+}
+
+// Blanks up to BLANKS more clues from each puzzle, in a random order, keeping each
+// blank only if the puzzle still has just the one solution (with no two rows or
+// columns the same). Puzzles the rules alone can still finish are made again, up
+// to HARD_TRIES times - some have no clue that can go, and are left out.
+// *made is set to how many there are.
+board* makeHard(board* puzzles, int n, uint64_t* seed, int* made)
+{
+   board* hard = (board*)malloc(n * sizeof(board));
+   assert(hard);
+   ruleset rs;
+   setRules(&rs, true, true);
+   *made = 0;
+   for(int i=0; i<n; i++){
+      for(int go=0; go<HARD_TRIES; go++){
+         board* h = &hard[*made];
+         *h = puzzles[i];
+         for(int b=0, tries=0; b<BLANKS && tries<SIZE*SIZE; tries++){
+            int row = (int)(xorshift(seed) % SIZE), col = (int)(xorshift(seed) % SIZE);
+            char was = h->b2d[row][col];
+            if(was != UNK){
+               h->b2d[row][col] = UNK;
+               if(count_solutions(h, &rs, 2) == 1){
+                  b++;
+               }
+               else{
+                  h->b2d[row][col] = was;
+               }
+            }
+         }
+         board tmp = *h;
+         if(!solve_board(&tmp)){
+            (*made)++;
+            break;
+         }
+      }
+   }
+   return hard;
+}
+
+// How long search_board() takes over the hard puzzles
+void timeSearch(board* hard, int n)
+{
+   double* times = (double*)malloc(n * sizeof(double));
+   long* nodes = (long*)malloc(n * sizeof(long));
+   assert(times && nodes);
+
+   long total = 0;
+   double t = now();
+   for(int i=0; i<n; i++){
+      board tmp = hard[i];
+      double start = now();
+      assert(search_board(&tmp, NULL, &nodes[i]));
+      times[i] = now() - start;
+      total += nodes[i];
+      assert(isSolutionTo(&tmp, &hard[i]));
+   }
+   t = now() - t;
+
+   qsort(times, n, sizeof(double), cmpDouble);
+   qsort(nodes, n, sizeof(long), cmpLong);
+   printf("search_board on those :\n");
+   printf("   %.0f nodes/s, %.1f nodes per puzzle (median %ld, max %ld)\n",
+          total / t, (double)total / n, nodes[n/2], nodes[n-1]);
+   printf("   us per puzzle : min %.1f, median %.1f, 90%% %.1f, 99%% %.1f, max %.1f\n",
+          times[0] * 1e6, times[n/2] * 1e6, times[n*9/10] * 1e6, times[n*99/100] * 1e6, times[n-1] * 1e6);
+
+   free(times);
+   free(nodes);
+}
+
+// Full, keeps the puzzle's clues, and breaks no rule
+bool isSolutionTo(board* brd, board* puzzle)
+{
+   for(int row=0; row<brd->sz; row++){
+      int inRow = 0, inCol = 0;
+      for(int col=0; col<brd->sz; col++){
+         char val = brd->b2d[row][col];
+         if(val == UNK || (puzzle->b2d[row][col] != UNK && puzzle->b2d[row][col] != val)){
+            return false;
+         }
+         if(col >= 2 && brd->b2d[row][col-1] == val && brd->b2d[row][col-2] == val){
+            return false;
+         }
+         if(col >= 2 && brd->b2d[col-1][row] == brd->b2d[col][row] && brd->b2d[col-2][row] == brd->b2d[col][row]){
+            return false;
+         }
+         inRow += (val == ONE);
+         inCol += (brd->b2d[col][row] == ONE);
+      }
+      if(inRow != brd->sz/2 || inCol != brd->sz/2){
+         return false;
+      }
+   }
+   return true;
+}
+
+int cmpDouble(const void* a, const void* b)
+{
+   double x = *(const double*)a, y = *(const double*)b;
+   return (x > y) - (x < y);
+}
+
+int cmpLong(const void* a, const void* b)
+{
+   long x = *(const long*)a, y = *(const long*)b;
+   return (x > y) - (x < y);
+}
+
+// The hard puzzles again, with each mix of the extra rules : how many the rules
+// finish alone and how fast, how much searching is left, and what each rule did
+void timeRules(board* hard, int n)
+{
+   printf("rules on the same puzzles :\n");
+   printf("   %-17s %8s %9s %9s %11s", "extra rules", "solved", "us/solve", "nodes", "us/search");
+   for(rule_id r=rule_pairs; r<NUMRULES; r++){
+      printf(" %10s", rule_name(r));
+   }
+   printf("\n");
+
+   for(int mix=0; mix<4; mix++){
+      bool unique = (mix & 1), lookahead = (mix & 2);
+      ruleset rs;
+      setRules(&rs, unique, lookahead);
+      int solved = 0;
+      double t = now();
+      for(int i=0; i<n; i++){
+         board tmp = hard[i];
+         if(solve_rules(&tmp, &rs)){
+            assert(isSolutionTo(&tmp, &hard[i]));
+            solved++;
+         }
+      }
+      t = now() - t;
+      long nodes = 0;
+      double ts = now();
+      for(int i=0; i<n; i++){
+         board tmp = hard[i];
+         long guesses;
+         ruleset search;
+         setRules(&search, unique, lookahead);
+         assert(search_board(&tmp, &search, &guesses));
+         assert(isSolutionTo(&tmp, &hard[i]));
+         nodes += guesses;
+      }
+      ts = now() - ts;
+
+      printf("   %-17s %4d/%-3d %9.1f %9.1f %11.1f", unique ? (lookahead ? "both" : "unique") : (lookahead ? "lookahead" : "none"),
+             solved, n, t * 1e6 / n, (double)nodes / n, ts * 1e6 / n);
+      for(rule_id r=rule_pairs; r<NUMRULES; r++){
+         printf(" %10ld", rs.hits[r]);
+      }
+      printf("\n");
+   }
+}
+
+// The default rules, with the extra ones as asked for
+void setRules(ruleset* rs, bool unique, bool lookahead)
+{
+   default_rules(rs);
+   rs->on[rule_unique] = unique;
+   rs->on[rule_lookahead] = lookahead;
+}
@@ -43,6 +43,12 @@ int main(void)
    assert(str2board(&b, "...1.0.........1"));
    assert(solve_board(&b)==false);
 
+   // ... but it can be solved by guessing
+   assert(str2board(&b, "...1.0.........1"));
+   assert(search_board(&b, NULL, NULL)==true);
+   board2str(str, &b);
+   assert(strcmp(str, "0011101011000101")==0);
+
    // Solvable 6x6 Board
    assert(str2board(&b, "1...1...0.....00...1................"));
    assert(solve_board(&b)==true);